@@ -7,60 +7,637 @@
 #include <condition_variable>
 #include <chrono>
 #include <atomic>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 /*
 [核心觀念]
 - block I/O (阻塞式 I/O) 的挑戰
 - 如何cancel task (如何優雅地取消任務)
 - std::condition_variable 的妙用：打破阻塞
+
+[延伸: 共用的 stop source / stop token (仿 C++20 std::stop_source)]
+原本一個 `CancellableTask` 綁一組 mutex / condvar / flag，`cancel()` 又只 `notify_one`，
+要把同一個請求分給幾十個 worker、再一次全部取消就做不到。改成把「取消狀態」拆出來共用:
+1.  **`StopSource` / `StopToken`**: source 持有共用的 `StopState` (一次 make_shared)，token 只是它的複本。
+    `request_stop()` 由 source 呼叫；token 給 worker 檢查或等待。一個 source 可以發出任意多個 token。
+2.  **檢查是 relaxed load**: `stop_requested()` 只讀一個 atomic<bool>，可以放在熱迴圈裡每次都檢查。
+    需要看到「取消前」寫下的資料時，要靠 callback 或 `wait_for` (兩者都經過 mutex)。
+3.  **callback 不配置**: `StopCallback<F>` 自己就是串列節點 (intrusive)，通常放在 worker 的 stack 上，
+    註冊只是在 mutex 下把自己掛上雙向串列；解構時拔下。已經取消過的 token 註冊時直接在當下執行 callback。
+    解構時如果 callback 正在別的執行緒上執行，會等它跑完才 return (所以 callback 用到的東西不會先被釋放)。
+4.  **一次喚醒全部**: 所有在 `wait_for` 的 worker 共用 state 裡的同一個 condition variable。
+    `request_stop()` 設旗標、依序執行已註冊的 callback (例如對 eventfd 寫入、關 socket 這類無法用 condvar
+    打斷的阻塞)，最後 `notify_all()` 一次叫醒全部。先跑 callback 再叫醒，跟 std::stop_source 的順序一樣:
+    worker 醒來就會解構自己的 callback，先叫醒的話它的 callback 可能還沒輪到就被拔掉了。
+
+[延伸: 可取消的 fd 阻塞 I/O (poll + eventfd，Linux)]
+`stoppable_slow_io` 只是用 `cv_.wait_for` 模擬 I/O。真的卡在 pipe 或 socket 的 `read()` 不會因為 notify 而醒來，
+關機時只能等逾時。`CancellableIo` 讓每次讀寫都同時等兩個 fd:
+1.  **資料 fd + eventfd 一起 poll**: 資料 fd 設成 O_NONBLOCK，`read` / `write` 先試一次，`EAGAIN` 才去 `poll`
+    {資料 fd, eventfd}。`cancel()` 只是對 eventfd 寫入 1 (async-signal-safe，任何執行緒或 StopCallback 都能呼叫)，
+    poll 立刻返回，沒有輪詢間隔，也不需要另外 close 或送 signal。
+2.  **取消是持續的**: eventfd 的計數不會被讀掉，所以同時卡在同一個物件上的多個執行緒都會醒來，
+    之後的讀寫也會直接以 `ECANCELED` 失敗；要重用就呼叫 `reset()`。
+3.  **回傳值跟 POSIX 一樣**: 成功回傳位元組數 (`read` 回傳 0 代表 EOF)，失敗回傳 -1 並設定 errno
+    (`ECANCELED`: 被取消；`ETIMEDOUT`: 超過 timeout_ms)。進入 `read` / `write` 時算一次絕對的截止時間，
+    poll 被 signal 打斷 (EINTR) 或假喚醒 (poll 說可讀，read 卻 EAGAIN) 都只用剩下的時間重試，不會把期限往後推。
+4.  **搭配 StopToken**: `read(buf, n, token)` 在讀的期間註冊一個 StopCallback 呼叫 `cancel()`，
+    一次 `request_stop()` 就能打斷幾十個卡在不同 socket 上的 worker。
 */
 
-class CancellableTask {
+class StopState;
+
+// StopCallback 的共同部分: 串列指標 + 呼叫方式 (函式指標，不用 virtual)
+class StopCallbackBase {
 private:
+    friend class StopState;
+    StopCallbackBase* prev_ = nullptr;
+    StopCallbackBase* next_ = nullptr;
+    void (*invoke_)(StopCallbackBase*);
+
+protected:
+    explicit StopCallbackBase(void (*invoke)(StopCallbackBase*)) : invoke_(invoke) {}
+};
+
+class StopState {
+private:
+    std::atomic<bool> stop_requested_{false};
     std::mutex mtx_;
-    std::condition_variable cv_;
-    std::atomic<bool> is_cancelled_{false};
+    std::condition_variable cv_;          // 等待取消的 worker 共用
+    std::condition_variable callback_cv_; // 等「正在執行的 callback」結束
+    StopCallbackBase* callbacks_ = nullptr;
+    StopCallbackBase* running_ = nullptr; // 正在執行的 callback
+    std::thread::id stopping_thread_;
+
+public:
+    bool stop_requested() const { return stop_requested_.load(std::memory_order_relaxed); }
+
+    // 只有第一次呼叫會回傳 true
+    bool request_stop() {
+        std::unique_lock<std::mutex> lock(mtx_);
+        if (stop_requested_.exchange(true, std::memory_order_relaxed)) {
+            return false;
+        }
+        stopping_thread_ = std::this_thread::get_id();
+        while (callbacks_) {
+            StopCallbackBase* callback = callbacks_;
+            callbacks_ = callback->next_;
+            if (callbacks_) {
+                callbacks_->prev_ = nullptr;
+            }
+            callback->prev_ = callback->next_ = nullptr;
+            running_ = callback;
+            lock.unlock();
+            callback->invoke_(callback);
+            lock.lock();
+            running_ = nullptr;
+            callback_cv_.notify_all();
+        }
+        cv_.notify_all();
+        return true;
+    }
+
+    // 回傳 false 代表已經取消過了，呼叫者要自己執行 callback
+    bool add_callback(StopCallbackBase* callback) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (stop_requested_.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        callback->next_ = callbacks_;
+        if (callbacks_) {
+            callbacks_->prev_ = callback;
+        }
+        callbacks_ = callback;
+        return true;
+    }
+
+    void remove_callback(StopCallbackBase* callback) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        if (callback == callbacks_ || callback->prev_) {
+            if (callback->prev_) {
+                callback->prev_->next_ = callback->next_;
+            } else {
+                callbacks_ = callback->next_;
+            }
+            if (callback->next_) {
+                callback->next_->prev_ = callback->prev_;
+            }
+            return;
+        }
+        // 已經被 request_stop() 拿走: 正在別的執行緒執行的話等它跑完 (在 callback 裡解構自己則不用等)
+        if (running_ == callback && stopping_thread_ != std::this_thread::get_id()) {
+            callback_cv_.wait(lock, [this, callback] { return running_ != callback; });
+        }
+    }
+
+    // 等到取消或逾時；回傳是否已取消
+    template <typename Rep, typename Period>
+    bool wait_for(const std::chrono::duration<Rep, Period>& timeout) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        return cv_.wait_for(lock, timeout, [this] { return stop_requested_.load(std::memory_order_relaxed); });
+    }
+};
+
+class StopToken {
+private:
+    std::shared_ptr<StopState> state_;
+
+public:
+    StopToken() = default;
+    explicit StopToken(std::shared_ptr<StopState> state) : state_(std::move(state)) {}
+
+    // relaxed load，熱迴圈裡也可以每次檢查
+    bool stop_requested() const { return state_ && state_->stop_requested(); }
+    bool stop_possible() const { return state_ != nullptr; }
+
+    template <typename Rep, typename Period>
+    bool wait_for(const std::chrono::duration<Rep, Period>& timeout) const {
+        if (!state_) {
+            std::this_thread::sleep_for(timeout);
+            return false;
+        }
+        return state_->wait_for(timeout);
+    }
+
+    template <typename F>
+    friend class StopCallback;
+};
+
+class StopSource {
+private:
+    std::shared_ptr<StopState> state_;
+
+public:
+    StopSource() : state_(std::make_shared<StopState>()) {}
+
+    StopToken get_token() const { return StopToken(state_); }
+    bool stop_requested() const { return state_->stop_requested(); }
+
+    // 依序執行所有 callback，再叫醒所有等待中的 worker；只有第一次呼叫會回傳 true
+    bool request_stop() { return state_->request_stop(); }
+};
+
+// 在生命週期內，token 被取消時呼叫 callback；註冊與解除都不配置記憶體
+template <typename F>
+class StopCallback : private StopCallbackBase {
+private:
+    std::shared_ptr<StopState> state_;
+    F callback_;
+    bool registered_ = false;
+
+    static void invoke(StopCallbackBase* self) { static_cast<StopCallback*>(self)->callback_(); }
+
+public:
+    StopCallback(const StopToken& token, F callback)
+        : StopCallbackBase(&StopCallback::invoke), state_(token.state_), callback_(std::move(callback)) {
+        if (state_) {
+            registered_ = state_->add_callback(this);
+            if (!registered_) {
+                callback_();
+            }
+        }
+    }
+
+    ~StopCallback() {
+        if (registered_) {
+            state_->remove_callback(this);
+        }
+    }
+
+    StopCallback(const StopCallback&) = delete;
+    StopCallback& operator=(const StopCallback&) = delete;
+};
+
+class CancellableTask {
+private:
+    StopSource own_source_;   // 沒有給 token 時自己的 source
+    StopToken token_;
+    bool verbose_ = true;
+
+    void log(const char* message) {
+        if (verbose_) {
+            std::cout << message << std::endl;
+        }
+    }
 
     // 模擬一個慢速的、可被喚醒的 I/O 操作
     void stoppable_slow_io() {
-        std::unique_lock lock(mtx_);
-        std::cout << "[Worker] Starting slow I/O, will wait up to 10 seconds..." << std::endl;
+        log("[Worker] Starting slow I/O, will wait up to 10 seconds...");
 
-        // cv_.wait_for: 等待一段時間，或直到被 notify() 喚醒
-        // 它會檢查一個 predicate (第三個參數)，如果為 true 就直接返回，避免 spurious wakeups
-        if (cv_.wait_for(lock, std::chrono::seconds(10), [this]{ return is_cancelled_.load(); })) {
+        // token.wait_for: 等待一段時間，或直到 request_stop() 喚醒
+        // 內部是 condition_variable::wait_for 加上 predicate，所以不怕 spurious wakeups
+        if (token_.wait_for(std::chrono::seconds(10))) {
             // 這裡是 true 的情況：
-            // 代表 wait_for 是因為 is_cancelled_ 變成了 true 而返回。
-            // 這一定是 cancel() 函式呼叫了 notify_one() 造成的。
-            std::cout << "[Worker] Woken up because task was cancelled." << std::endl;
+            // 代表 wait_for 是因為 stop_requested 變成了 true 而返回。
+            // 這一定是 request_stop() 呼叫了 notify_all() 造成的。
+            log("[Worker] Woken up because task was cancelled.");
         } else {
             // 這裡是 false 的情況：
-            // 代表等待了整整 10 秒鐘，is_cancelled_ 始終是 false，
-            // notify_one() 也沒有被呼叫。是超時了。
-            std::cout << "[Worker] I/O operation finished normally after timeout." << std::endl;
+            // 代表等待了整整 10 秒鐘，始終沒有人取消。是超時了。
+            log("[Worker] I/O operation finished normally after timeout.");
         }
     }
 
 public:
+    CancellableTask() : token_(own_source_.get_token()) {}
+
+    // 多個 task 共用同一個 token，由外部的 StopSource 一次取消
+    explicit CancellableTask(StopToken token, bool verbose = true) : token_(std::move(token)), verbose_(verbose) {}
+
     void run() {
-        std::cout << "[Worker] Task started." << std::endl;
+        log("[Worker] Task started.");
         stoppable_slow_io();
-        if (is_cancelled_) {
-             std::cout << "[Worker] Task exiting due to cancellation." << std::endl;
+        if (token_.stop_requested()) {
+            log("[Worker] Task exiting due to cancellation.");
         } else {
-             std::cout << "[Worker] Task exiting normally." << std::endl;
+            log("[Worker] Task exiting normally.");
         }
     }
 
+    // 只取消自己的 source；共用 token 的 task 要由外部的 StopSource 取消
     void cancel() {
         std::cout << "[Main]   Sending cancel signal to worker..." << std::endl;
-        // 1. 設定旗標
-        is_cancelled_ = true;
-        // 2. 喚醒正在等待的執行緒
-        cv_.notify_one();
+        own_source_.request_stop();
     }
+
+    bool cancelled() const { return token_.stop_requested(); }
 };
 
+// 讀寫一個 fd，隨時可以被 cancel() 打斷 (見上方說明)；fd 本身不歸這個物件管
+class CancellableIo {
+private:
+    int fd_;
+    int cancel_fd_;
+
+    typedef std::chrono::steady_clock::time_point TimePoint;
+
+    // timeout_ms < 0 代表不限時間 (time_point::max())
+    static TimePoint deadline_after(int timeout_ms) {
+        return timeout_ms < 0 ? TimePoint::max() : std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    }
+
+    // 等到 fd 可以讀 / 寫或過了 deadline；回傳 0，或 -1 + errno (ECANCELED / ETIMEDOUT / poll 的錯誤)。
+    // deadline 是絕對時間，由 read / write 進來時算一次，所以 EINTR 或「poll 說可讀、read 卻 EAGAIN」重試都不會延長它
+    int wait(short events, TimePoint deadline) {
+        while (true) {
+            int remaining = -1;
+            if (deadline != TimePoint::max()) {
+                // 無條件進位到 ms，poll 不會比 deadline 早返回
+                auto left = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now());
+                remaining = left.count() > 0 ? static_cast<int>((left.count() + 999) / 1000) : 0;
+            }
+            pollfd fds[2] = {{fd_, events, 0}, {cancel_fd_, POLLIN, 0}};
+            int ready = ::poll(fds, 2, remaining);
+            if (ready < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+            if (fds[1].revents & POLLIN) {
+                errno = ECANCELED;
+                return -1;
+            }
+            if (ready == 0) {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+            return 0; // 包含 POLLHUP / POLLERR: 交給接下來的 read / write 回報
+        }
+    }
+
+    bool cancel_pending() const {
+        pollfd fd = {cancel_fd_, POLLIN, 0};
+        return ::poll(&fd, 1, 0) > 0;
+    }
+
+public:
+    // 會把 fd 設成 O_NONBLOCK；eventfd 建立失敗丟 std::system_error
+    explicit CancellableIo(int fd) : fd_(fd), cancel_fd_(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+        if (cancel_fd_ < 0) {
+            throw std::system_error(errno, std::generic_category(), "eventfd");
+        }
+        int flags = ::fcntl(fd_, F_GETFL);
+        if (flags < 0 || ::fcntl(fd_, F_SETFL, flags | O_NONBLOCK) < 0) {
+            int error = errno;
+            ::close(cancel_fd_);
+            throw std::system_error(error, std::generic_category(), "fcntl(O_NONBLOCK)");
+        }
+    }
+
+    ~CancellableIo() { ::close(cancel_fd_); }
+
+    CancellableIo(const CancellableIo&) = delete;
+    CancellableIo& operator=(const CancellableIo&) = delete;
+
+    // timeout_ms < 0: 不限時間
+    ssize_t read(void* buf, size_t len, int timeout_ms = -1) {
+        TimePoint deadline = deadline_after(timeout_ms);
+        while (true) {
+            if (cancel_pending()) {
+                errno = ECANCELED;
+                return -1;
+            }
+            ssize_t n = ::read(fd_, buf, len);
+            if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                return n;
+            }
+            if (errno != EINTR && wait(POLLIN, deadline) < 0) {
+                return -1;
+            }
+        }
+    }
+
+    // 跟 ::write 一樣可能只寫了一部分
+    ssize_t write(const void* buf, size_t len, int timeout_ms = -1) {
+        TimePoint deadline = deadline_after(timeout_ms);
+        while (true) {
+            if (cancel_pending()) {
+                errno = ECANCELED;
+                return -1;
+            }
+            ssize_t n = ::write(fd_, buf, len);
+            if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                return n;
+            }
+            if (errno != EINTR && wait(POLLOUT, deadline) < 0) {
+                return -1;
+            }
+        }
+    }
+
+    // 讀的期間 token 被取消就打斷 (StopCallback 放在 stack 上，不配置)
+    ssize_t read(void* buf, size_t len, const StopToken& token, int timeout_ms = -1) {
+        auto on_stop = [this] { cancel(); };
+        StopCallback<decltype(on_stop)> callback(token, on_stop);
+        return read(buf, len, timeout_ms);
+    }
+
+    ssize_t write(const void* buf, size_t len, const StopToken& token, int timeout_ms = -1) {
+        auto on_stop = [this] { cancel(); };
+        StopCallback<decltype(on_stop)> callback(token, on_stop);
+        return write(buf, len, timeout_ms);
+    }
+
+    // 任何執行緒都可以呼叫 (也是 async-signal-safe)
+    void cancel() {
+        uint64_t one = 1;
+        ssize_t ignored = ::write(cancel_fd_, &one, sizeof(one));
+        (void)ignored; // 計數滿了 (EAGAIN) 也一樣是「已取消」
+    }
+
+    bool cancelled() const { return cancel_pending(); }
+
+    // 清掉取消狀態，物件可以再用 (呼叫時不要有其他執行緒還在讀寫)
+    void reset() {
+        uint64_t count = 0;
+        ssize_t ignored = ::read(cancel_fd_, &count, sizeof(count));
+        (void)ignored;
+    }
+};
+
+// --- 配置計數 (驗證 callback 註冊不配置用) ---
+static std::atomic<long> g_allocations{0};
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// 一個 StopSource 取消 32 個共用 token 的 worker
+void test_fan_out_cancellation() {
+    std::cout << "\n--- Fan-out Cancellation with a Shared Stop Token ---" << std::endl;
+    const int kWorkers = 32;
+    StopSource source;
+    std::vector<std::unique_ptr<CancellableTask>> tasks;
+    std::atomic<int> callbacks_run{0};
+    std::atomic<int> registered{0};
+    std::vector<std::thread> workers;
+    std::vector<double> wake_ms(kWorkers, -1);
+    std::chrono::steady_clock::time_point cancel_time;
+
+    for (int i = 0; i < kWorkers; ++i) {
+        tasks.emplace_back(new CancellableTask(source.get_token(), false));
+    }
+    for (int i = 0; i < kWorkers; ++i) {
+        workers.emplace_back([&, i] {
+            StopToken token = source.get_token();
+            auto on_stop = [&callbacks_run] { callbacks_run.fetch_add(1); };
+            StopCallback<decltype(on_stop)> callback(token, on_stop);
+            registered.fetch_add(1);
+            tasks[i]->run();
+            wake_ms[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cancel_time).count();
+        });
+    }
+    while (registered.load() < kWorkers) {
+        std::this_thread::yield();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    cancel_time = std::chrono::steady_clock::now();
+    bool first = source.request_stop();
+    bool second = source.request_stop();
+    for (auto& w : workers) {
+        w.join();
+    }
+
+    double slowest = 0;
+    int cancelled = 0;
+    for (int i = 0; i < kWorkers; ++i) {
+        slowest = std::max(slowest, wake_ms[i]);
+        cancelled += tasks[i]->cancelled() ? 1 : 0;
+    }
+    std::cout << kWorkers << " workers cancelled by one request_stop(): " << cancelled << " cancelled, "
+              << callbacks_run.load() << " callbacks, slowest wake-up " << slowest << " ms"
+              << ((cancelled == kWorkers && callbacks_run.load() == kWorkers && first && !second && slowest < 1000)
+                      ? " (passed)"
+                      : " (failed)")
+              << std::endl;
+
+    // 註冊 / 解除 callback 不配置；已取消的 token 註冊時立刻執行；解除後不再被呼叫
+    StopSource fresh;
+    StopToken token = fresh.get_token();
+    int fired = 0;
+    auto count = [&fired] { ++fired; };
+    long before = g_allocations.load();
+    for (int i = 0; i < 1000; ++i) {
+        StopCallback<decltype(count)> callback(token, count);
+    }
+    long allocations = g_allocations.load() - before;
+    {
+        StopCallback<decltype(count)> kept(token, count);
+        fresh.request_stop();
+        StopCallback<decltype(count)> late(token, count);
+    }
+    std::cout << "1000 callback registrations: " << allocations << " allocations"
+              << (allocations == 0 ? " (passed)" : " (failed)") << "; deregistered callbacks skipped, late one ran "
+              << (fired == 2 ? "(passed)" : "(failed)") << std::endl;
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+void test_cancellable_io() {
+    std::cout << "\n--- Cancellable fd I/O (poll + eventfd) ---" << std::endl;
+
+    // 1. pipe: 有資料就讀到資料；沒資料時卡住，cancel() 立刻打斷
+    {
+        int fds[2];
+        if (::pipe(fds) != 0) {
+            std::cout << "pipe() failed: " << std::strerror(errno) << std::endl;
+            return;
+        }
+        CancellableIo reader(fds[0]);
+        char buf[16] = {};
+        ssize_t written = ::write(fds[1], "ping", 4);
+        ssize_t n = reader.read(buf, sizeof(buf));
+        bool data_ok = written == 4 && n == 4 && std::string(buf, 4) == "ping";
+
+        std::chrono::steady_clock::time_point cancel_time;
+        ssize_t result = 0;
+        int error = 0;
+        double wake_ms = -1;
+        std::thread blocked([&] {
+            result = reader.read(buf, sizeof(buf));
+            error = errno;
+            wake_ms = elapsed_ms(cancel_time);
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        cancel_time = std::chrono::steady_clock::now();
+        reader.cancel();
+        blocked.join();
+
+        reader.reset();
+        auto start = std::chrono::steady_clock::now();
+        ssize_t timed = reader.read(buf, sizeof(buf), 50);
+        int timed_error = errno;
+        double timed_ms = elapsed_ms(start);
+
+        std::cout << "pipe: read data" << (data_ok ? " (passed)" : " (failed)") << ", blocked read cancelled after "
+                  << wake_ms << " ms" << ((result == -1 && error == ECANCELED && wake_ms < 50) ? " (passed)" : " (failed)")
+                  << ", 50 ms timeout took " << timed_ms << " ms"
+                  << ((timed == -1 && timed_error == ETIMEDOUT && timed_ms >= 50) ? " (passed)" : " (failed)")
+                  << std::endl;
+        ::close(fds[0]);
+        ::close(fds[1]);
+    }
+
+    // 2. socketpair: 把送出緩衝區塞滿，卡在 write 的執行緒由 StopToken 取消
+    {
+        int sv[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+            std::cout << "socketpair() failed: " << std::strerror(errno) << std::endl;
+            return;
+        }
+        CancellableIo writer(sv[0]);
+        std::vector<char> chunk(64 * 1024, 'x');
+        size_t buffered = 0;
+        while (true) {
+            ssize_t n = writer.write(chunk.data(), chunk.size(), 0);
+            if (n <= 0) {
+                break;
+            }
+            buffered += static_cast<size_t>(n);
+        }
+
+        StopSource source;
+        std::chrono::steady_clock::time_point cancel_time;
+        ssize_t result = 0;
+        int error = 0;
+        double wake_ms = -1;
+        std::thread blocked([&] {
+            result = writer.write(chunk.data(), chunk.size(), source.get_token());
+            error = errno;
+            wake_ms = elapsed_ms(cancel_time);
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        cancel_time = std::chrono::steady_clock::now();
+        source.request_stop();
+        blocked.join();
+        std::cout << "socketpair: write blocked after " << buffered / 1024 << " KiB, cancelled via StopToken after "
+                  << wake_ms << " ms" << ((result == -1 && error == ECANCELED && wake_ms < 50) ? " (passed)" : " (failed)")
+                  << std::endl;
+        ::close(sv[0]);
+        ::close(sv[1]);
+    }
+
+    // 3. 8 個 worker 各自卡在自己的 socket 上，一次 request_stop() 全部打斷
+    {
+        const int kReaders = 8;
+        int pairs[kReaders][2];
+        std::vector<std::unique_ptr<CancellableIo>> ios;
+        for (int i = 0; i < kReaders; ++i) {
+            if (::socketpair(AF_UNIX, SOCK_STREAM, 0, pairs[i]) != 0) {
+                std::cout << "socketpair() failed: " << std::strerror(errno) << std::endl;
+                return;
+            }
+            ios.emplace_back(new CancellableIo(pairs[i][0]));
+        }
+        StopSource source;
+        std::chrono::steady_clock::time_point cancel_time;
+        std::atomic<int> cancelled{0};
+        std::vector<double> wake_ms(kReaders, -1);
+        std::vector<std::thread> readers;
+        for (int i = 0; i < kReaders; ++i) {
+            readers.emplace_back([&, i] {
+                char buf[64];
+                if (ios[i]->read(buf, sizeof(buf), source.get_token()) == -1 && errno == ECANCELED) {
+                    cancelled.fetch_add(1);
+                }
+                wake_ms[i] = elapsed_ms(cancel_time);
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        cancel_time = std::chrono::steady_clock::now();
+        source.request_stop();
+        for (auto& r : readers) {
+            r.join();
+        }
+        double slowest = *std::max_element(wake_ms.begin(), wake_ms.end());
+        std::cout << kReaders << " socket readers cancelled by one request_stop(): " << cancelled.load()
+                  << ", slowest " << slowest << " ms"
+                  << ((cancelled.load() == kReaders && slowest < 50) ? " (passed)" : " (failed)") << std::endl;
+        for (int i = 0; i < kReaders; ++i) {
+            ::close(pairs[i][0]);
+            ::close(pairs[i][1]);
+        }
+    }
+}
+
 // --- main 函式用於測試 ---
 int main() {
     std::cout << "--- Testing Cancellable Blocking Task ---" << std::endl;
@@ -80,6 +657,9 @@ int main() {
     // 4. 等待工作執行緒完全結束
     worker.join();
 
+    test_fan_out_cancellation();
+    test_cancellable_io();
+
     std::cout << "--- Test Ended ---" << std::endl;
     return 0;
 }
@@ -87,4 +667,4 @@ int main() {
 /*
 如何編譯與執行:
 g++ your_file_name.cpp -std=c++11 -o program -pthread
-*/
\ No newline at end of file
+*/
@@ -7,71 +7,2253 @@
 #include <functional>
 #include <chrono>
 #include <thread>
+#include <cstdint>
+#include <random>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <deque>
+#include <algorithm>
+#include <stdexcept>
+#include <ctime>
+#include <new>
+#include <type_traits>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <utility>
+#include <cmath>
+
+// C++20 以上才編譯協程介面 (CMake 的 delay_task_scheduling_cpp20 target)
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#define TASK_SCHEDULER_HAS_COROUTINES 1
+#endif
+#endif
+#ifndef TASK_SCHEDULER_HAS_COROUTINES
+#define TASK_SCHEDULER_HAS_COROUTINES 0
+#endif
 
 /*
 [核心觀念]
 - task scheduling (任務調度)
 - delay task (延遲任務)
 - task prioritization (任務優先權)
+
+[延伸: 階層式時間輪 (Hierarchical Timing Wheel)]
+延遲任務原本放在 `std::priority_queue`，插入和取出都是 O(log n)，而且無法在中途取消。
+大量「設定逾時、多半在到期前就取消」的場景，改用 Linux kernel 舊版 timer 的階層式時間輪:
+1.  **tick**: 把時間切成固定長度的 tick (建構子可設定，預設 1 ms)。延遲任務的到期 tick 取「無條件進位」，
+    所以任務永遠不會提早執行，最多晚一個 tick。
+2.  **4 層 x 256 格**: 第 0 層每格代表 1 個 tick，第 1 層每格 256 個 tick，依此類推，共可表示 2^32 個 tick。
+    插入時依「距離現在多遠」決定放在哪一層的哪一格，只要算 shift/mask，O(1)。
+3.  **每格是雙向鏈結串列**: 節點記得自己在哪一層哪一格，取消時直接從串列拔掉，O(1)。
+4.  **cascade**: 第 0 層轉完一圈 (tick 的低 8 bits 歸 0) 時，把上一層對應那一格的節點重新分配到下層。
+    每個節點最多被搬動「層數」次，攤還後仍是 O(1)。
+5.  **跳過空格**: 每一層用 256-bit 的 bitmap 記錄哪些格子有節點，推進時間或計算「下一次要醒來的時間」
+    都直接找下一個 set bit，不必一格一格走，閒置時也能精準 sleep 到下一個到期點。
+
+[延伸: 多執行緒 work-stealing executor]
+`run()` 原本在呼叫者的執行緒上逐一執行任務，只用得到一顆核心。建構時指定 `worker_threads > 0` 就會改用 executor:
+1.  **Chase-Lev deque**: 每個 worker 有自己的 deque。擁有者在 bottom 端 push/pop (LIFO，cache 友善、幾乎不需同步)，
+    其他 worker 從 top 端 steal (FIFO，只有搶同一個元素時才需要 CAS)。陣列滿了就加倍，舊陣列保留到解構，
+    因為小偷可能還在讀它。
+2.  **近似的優先權**: priority 每 10 分成一個 band (0~9、10~19、20~29、30 以上)，每個 worker 每個 band 一個 deque。
+    取工作時由高 band 往低 band: 自己的 deque → 外部注入佇列 → 偷別人的 deque。
+    同一個 worker 內高優先權一定先做；跨 worker 與同一個 band 內則不保證嚴格順序。
+3.  **任務從哪裡進來**: worker 上執行的任務呼叫 `add_task` 時直接推進自己的 deque；其他執行緒提交的任務放進
+    有 mutex 的注入佇列。`run()` 的呼叫者變成 dispatcher，只負責推進時間輪，把到期的任務交給 executor。
+4.  **沒工作時不空轉**: `queued_` 計數待取的任務數。worker 先把 `sleepers_` 加一再檢查 `queued_`，
+    提交者先把 `queued_` 加一再檢查 `sleepers_` (兩邊都是 seq_cst)，至少有一方會看到對方，不會漏掉喚醒。
+5.  **結束條件**: dispatcher 在時間輪為空、且 executor 沒有待執行或執行中的任務時結束；
+    executor 變成 idle 時會喚醒 dispatcher 重新檢查。
+
+[延伸: 執行緒安全的提交與閒置喚醒]
+`ready_queue_` 和時間輪都只允許 `run()` 的執行緒碰；其他執行緒 (包含任務本身) 一律透過提交佇列交進來。
+1.  **MPSC intrusive list**: 提交者把 `TaskNode` 用 CAS push 到 `submissions_` (Treiber stack)，不需要鎖也不需要額外配置。
+    消費者一次 `exchange(nullptr)` 把整串拿走再反轉成 FIFO，所以是一批一批 drain，沒有 ABA 問題。
+2.  **park 而不是 poll**: 沒事可做時 `run()` 在 condition variable 上 `wait_until(下一個到期 tick)`，
+    沒有延遲任務時就無限期等待。提交者 push 之後只有在 `sleeping_` 為 true 時才去拿鎖 notify；
+    消費者先設 `sleeping_` 再檢查佇列 (兩邊 seq_cst)，所以不會漏掉喚醒，也不會在忙碌時多付一次鎖的成本。
+    時間輪只會在「到期 tick」或「上層 cascade 的邊界」(每 256 個 tick 最多一次) 叫醒它。
+3.  **長時間運行**: `run()` 保留原本「全部做完就結束」的語意；`run_forever()` 則一直服務到有人呼叫 `stop()`，
+    讓其他執行緒可以持續餵任務。
+4.  executor 模式下，worker 上呼叫 `add_task` 仍然直接推進自己的 deque；其他立即任務同樣可以直接交給 executor。
+
+[延伸: 小緩衝區 callable 與任務節點池 (穩態零配置)]
+`std::function` 對大多數有 capture 的 lambda 都會 heap 配置，而 `Task task = ready_queue_.top();` 又把 callable 複製一份。
+1.  **`TaskCallable`**: 只能 move 的 callable，內建 48 bytes 的 inline 儲存空間。放得下 (而且 move 不丟例外) 的
+    callable 直接 placement-new 在裡面；放不下的才退回 heap。型別抹除用一張靜態的函式指標表 (invoke / move / destroy)，
+    沒有 virtual，也沒有額外配置。
+2.  **佇列只放指標**: `ready_queue_` 改成 `priority_queue<TaskNode*>`，executor 的 deque 與注入佇列也都放 `TaskNode*`
+    (注入佇列改成 intrusive FIFO，不再用會配置區塊的 `std::deque`)。任務從提交到執行完都待在同一個節點裡，不會被複製。
+3.  **`TaskNodePool`**: 節點用完放回 free list，下次提交直接拿來用；不夠時一次配置 256 個一塊。
+    free list 用 mutex 保護，因為任何執行緒都可能提交、而 run 執行緒或 worker 負責歸還。
+4.  **驗證**: main 裡覆寫全域 `operator new` 計數，暖機一輪之後，第二輪的提交 / 延遲 / 執行應該是 0 次配置。
+
+[延伸: 取消 / 改期 handle 與週期任務]
+重試與逾時的寫法常常是「排一個 timeout，事情做完就不需要它了」，沒辦法取消的話，死掉的 callback 還是會被取出來執行。
+1.  **`TaskHandle`**: `run_task_after` 與 `run_every` 回傳 handle，記住節點指標與節點的 generation。
+    節點有一個 atomic 的 `state` = (generation << 4) | periodic | 狀態 (Pending / Due / Moving / Running / Cancelled)。
+    節點放回 pool 時 generation + 1，所以舊 handle 對重複使用的節點一律無效，不會誤殺別人的任務。
+2.  **`cancel()` O(1)**: 用 CAS 把 Pending 改成 Cancelled，只有成功的那一方算數。之後再送一個「取消命令」進提交佇列，
+    由 `run()` 的執行緒用 `TimingWheel::remove` 把節點直接從時間輪拔掉並回收 (時間輪只有它能碰)。
+    已經離開時間輪的節點 (在 ready queue 或 executor 裡) 則在執行前的 Pending → Running CAS 失敗時直接回收，不會執行。
+3.  **`reschedule(delay)` O(1)**: 同樣是送命令，`run()` 的執行緒把節點從時間輪拔下、改到期時間再插回去。
+    呼叫端先用 CAS 把 Pending 改成 Moving；計時器到期時則把 Pending 改成 Due，遇到 Moving 就先留在時間輪裡等命令。
+    所以兩者只會有一方成功: 任務已經到期 (Due，即使還在排隊)、正在執行或已取消時 `reschedule` 回傳 false，
+    跟 `cancel()` 對過期 handle 的回報一致。命令本身也是從 pool 拿的節點，不會配置。
+4.  **`run_every(period)` 不漂移**: 下一次的到期時間是「上一次的預定時間 + period」而不是「執行完的時間 + period」，
+    所以執行時間與排程延遲不會累積；落後超過一個 period 時直接跳過錯過的次數 (fixed rate)。
+    執行中 cancel 週期任務也會成功，這一次跑完之後就不再排下一次。`run()` 要等所有週期任務被取消後才會結束。
+
+[延伸: C++20 協程介面 (co_await sleep_for / yield)]
+「送出、等 500 ms、輪詢、再等」這種多步驟流程用 `run_task_after` 寫，就是一層包一層的 lambda，每一層都要配置、
+狀態散落在各個 capture 裡。以 C++20 編譯時 (`TASK_SCHEDULER_HAS_COROUTINES`) 多了一組協程介面:
+1.  **`CoTask`**: fire-and-forget 的協程型別。`initial_suspend` 先停住，`sched.spawn(priority, flow())` 才把第一次
+    resume 排進 ready queue；`final_suspend` 不停，跑完 frame 自己釋放。協程裡的例外視為程式錯誤 (terminate)。
+2.  **`co_await sched.sleep_for(d)` / `co_await sched.yield()`**: `await_suspend` 只是把 `[h] { h.resume(); }`
+    交給 `run_task_after` / `add_task`，所以恢復執行一律經過排程器的 ready queue (或 executor)，優先權沿用 spawn 時給的值。
+    executor 模式下 worker 可能在 `await_suspend` 還沒 return 前就 resume，所以它在排程之後不再碰 awaiter 本身。
+3.  **frame 配置**: `promise_type` 自帶 `operator new/delete`，frame 從 `CoroutineFramePool` 拿 (64 bytes 一級的 free list，
+    超過 1 KiB 才走一般配置)。resume 用的 lambda 只有一個 handle，放得進 `TaskCallable` 的 inline buffer，
+    節點也來自 pool，所以暖機之後整條流程不再配置。
+4.  C++11 的建置完全不受影響；CMake 以 `-DBUILD_CPP20_EXAMPLES=ON` 另外編一個 C++20 的執行檔。
+
+[延伸: 延遲與排隊時間的量測 (HDR 風格 histogram)]
+平均值看不出「偶爾晚 20 ms」這種問題，所以每個任務記三個值，放進 histogram 看分位數:
+1.  **lateness**: 延遲任務實際開始執行的時間 - `wake_time`。包含 tick 無條件進位、condition variable 睡過頭，
+    以及到期後在 ready queue 裡排隊的時間。
+2.  **queue wait**: 任務「可以執行」(立即任務: 提交時；延遲任務: 到期被放進 ready queue / executor 時) 到開始執行。
+    高優先權任務塞滿時，低優先權任務的 queue wait 會明顯拉長。
+3.  **execution**: 任務本身執行多久。
+`LatencyHistogram` 是 HDR histogram 的簡化版 (log-linear): 每個 2 的次方區間再平均切 16 格，
+所以任何值的相對誤差 < 1/16，從 1 ns 到 2^40 ns 只要 608 個 bucket。記錄一筆只有幾個 relaxed atomic 加法，
+worker 之間不需要鎖。每個優先權 band (跟 executor 一樣 priority / 10) 各有一組，`metrics_snapshot()` 複製出一份
+不再變動的快照，可以查 percentile / mean / max，總計則是各 band 合併。`set_metrics(false)` 可以整個關掉
+(省下每個任務 2~3 次讀時鐘)。
+
+[延伸: 截止時間 (EDF) 與 aging]
+原本 ready queue 只比 `priority`，只要一直有 priority 20 的任務進來，priority 5 的任務就永遠輪不到。
+1.  **統一的排序鍵**: 單執行緒模式的 ready queue 改比 `rank` (越小越先做)，任務變成 ready 時算一次:
+    - 截止時間任務 (`add_deadline_task`): rank = deadline，也就是 earliest deadline first。
+    - 一般任務: rank = ready 的時間 + (kTopPriority - priority) x aging quantum。
+      等於把 priority p 看成「相對截止時間 (40 - p) 個 quantum」: 一個等了 k 個 quantum 的任務，
+      跟一個剛進來、priority 高 k 的任務排在一起，所以任何任務最多被後來的任務超車 (40 - p) 個 quantum，不會餓死。
+      延遲任務的 ready 時間用 `wake_time`，不會因為 dispatcher 晚到而吃虧。
+2.  **為什麼不用真的「隨時間變大的優先權」**: 比較兩個任務時 now 會互相抵銷
+    (p_a + (now - t_a) / Q 對 p_b + (now - t_b) / Q)，所以固定的鍵就夠了，heap 不用重排，仍然是 O(log n)。
+3.  **預設值**: quantum 預設 100 ms，同時提交的任務仍然依 priority 排；`set_aging_quantum()` 可以調整，
+    調得很大就接近原本的嚴格優先權。
+4.  **deadline miss**: 截止時間任務跑完時比對 deadline，計入 `metrics_snapshot()` 的 met / missed 以及超過多少的 histogram。
+5.  executor 模式的 band 仍是嚴格的 (deque 沒辦法依任意鍵排序)，截止時間任務放在最高的 band；aging 只作用在單執行緒模式。
+
+[延伸: 任務相依圖 (DAG)]
+fan-out / fan-in 的 pipeline 原本要靠 callback 手動串接順序。`TaskGraph` 把節點與邊先建好，`sched.submit(graph)` 一次執行:
+1.  **atomic 前驅計數**: 每個節點記得自己有幾個前驅。提交時把計數重設，計數為 0 的節點直接排進排程器；
+    節點做完後對每個後繼 `fetch_sub`，減到 0 的那一方負責把後繼排進去。整個過程沒有中央的鎖:
+    單執行緒模式走 MPSC 提交佇列，executor 模式下 worker 直接推進自己的 deque，獨立的分支自然會被偷去平行執行。
+    `fetch_sub` 用 acq_rel，所以後繼一定看得到所有前驅寫的資料。
+2.  **重複使用**: 節點放在 `std::deque` (位址固定)，每個節點的後繼清單在建圖時配置好；
+    再次 `submit` 只重設計數器，排程用的節點也來自 pool，所以重複執行不會再配置。
+3.  **檢查**: 拓撲有變動時，下一次 `submit` 先用 Kahn's algorithm 檢查有沒有環 (有環丟 `std::invalid_argument`)；
+    上一輪還沒跑完就再 `submit` 丟 `std::logic_error`。`wait()` 讓其他執行緒等整張圖跑完。
 */
 
-using TimePoint = std::chrono::steady_clock::time_point;
+using TimePoint = std::chrono::steady_clock::time_point;
+
+// 只能 move 的 callable，48 bytes 以內的 callable 不會 heap 配置
+class TaskCallable {
+public:
+    static const size_t kInlineSize = 48;
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        void (*move)(void* dst, void* src); // 搬到 dst 並解構 src
+        void (*destroy)(void* storage);
+    };
+
+    template <typename F>
+    struct InlineOps {
+        static void invoke(void* p) { (*static_cast<F*>(p))(); }
+        static void move(void* dst, void* src) {
+            new (dst) F(std::move(*static_cast<F*>(src)));
+            static_cast<F*>(src)->~F();
+        }
+        static void destroy(void* p) { static_cast<F*>(p)->~F(); }
+        static const Ops* table() {
+            static const Ops ops = {&invoke, &move, &destroy};
+            return &ops;
+        }
+    };
+
+    template <typename F>
+    struct HeapOps {
+        static void invoke(void* p) { (**static_cast<F**>(p))(); }
+        static void move(void* dst, void* src) { *static_cast<F**>(dst) = *static_cast<F**>(src); }
+        static void destroy(void* p) { delete *static_cast<F**>(p); }
+        static const Ops* table() {
+            static const Ops ops = {&invoke, &move, &destroy};
+            return &ops;
+        }
+    };
+
+    alignas(std::max_align_t) unsigned char storage_[kInlineSize];
+    const Ops* ops_ = nullptr;
+
+public:
+    TaskCallable() = default;
+
+    template <typename F, typename D = typename std::decay<F>::type,
+              typename = typename std::enable_if<!std::is_same<D, TaskCallable>::value>::type>
+    TaskCallable(F&& f) {
+        if (sizeof(D) <= kInlineSize && alignof(D) <= alignof(std::max_align_t) &&
+            std::is_nothrow_move_constructible<D>::value) {
+            new (storage_) D(std::forward<F>(f));
+            ops_ = InlineOps<D>::table();
+        } else {
+            *reinterpret_cast<D**>(storage_) = new D(std::forward<F>(f));
+            ops_ = HeapOps<D>::table();
+        }
+    }
+
+    TaskCallable(TaskCallable&& other) noexcept : ops_(other.ops_) {
+        if (ops_) {
+            ops_->move(storage_, other.storage_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    TaskCallable& operator=(TaskCallable&& other) noexcept {
+        if (this != &other) {
+            reset();
+            ops_ = other.ops_;
+            if (ops_) {
+                ops_->move(storage_, other.storage_);
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    TaskCallable(const TaskCallable&) = delete;
+    TaskCallable& operator=(const TaskCallable&) = delete;
+
+    ~TaskCallable() { reset(); }
+
+    void reset() {
+        if (ops_) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+
+    void operator()() { ops_->invoke(storage_); }
+};
+
+struct Task {
+    int priority;
+    TaskCallable func;
+    TimePoint wake_time;
+
+    bool operator<(const Task& other) const {
+        return priority < other.priority;
+    }
+};
+
+struct DelayedTaskCompare {
+    bool operator()(const Task& a, const Task& b) const {
+        return a.wake_time > b.wake_time;
+    }
+};
+
+// 任務節點: 提交佇列 (單向，用 next) 與時間輪 (雙向) 共用同一組 intrusive 指標
+struct TaskNode {
+    // state 的低 4 bits (3 bits 狀態 + 週期旗標)；其餘是 generation，節點回收時加一
+    static const uint64_t kPending = 0;
+    static const uint64_t kRunning = 1;
+    static const uint64_t kCancelled = 2;
+    static const uint64_t kDue = 3;     // 計時器已到期，等待執行
+    static const uint64_t kMoving = 4;  // 改期命令還在送往 run() 執行緒的路上
+    static const uint64_t kStatusMask = 7;
+    static const uint64_t kPeriodic = 8;
+    static const int kGenerationShift = 4;
+
+    // 提交佇列裡除了任務，也可以是針對某個任務的命令
+    enum Kind : uint8_t { kTask, kCancelCommand, kRescheduleCommand };
+
+    Task task;
+    bool delayed = false;      // false: 立即執行；true: 等到 task.wake_time
+    Kind kind = kTask;
+    uint64_t expire_tick = 0;
+    TaskNode* prev = nullptr;
+    TaskNode* next = nullptr;
+    int level = -1;            // 在時間輪裡時 >= 0，只由 run() 的執行緒讀寫
+    int slot = -1;
+    TimePoint ready_time;      // 可以執行的時間 (量測 queue wait 用)
+    int64_t rank = 0;          // ready queue 的排序鍵，越小越先 (見 TaskScheduler::make_ready)
+    bool has_deadline = false;
+    TimePoint deadline;
+    std::atomic<uint64_t> state{0};
+    std::chrono::steady_clock::duration period{0}; // 週期任務的間隔
+
+    // 命令用
+    TaskNode* target = nullptr;
+    uint64_t target_generation = 0;
+
+    uint64_t generation() const { return state.load(std::memory_order_acquire) >> kGenerationShift; }
+
+    // Pending / Due → Running；被取消了就回傳 false
+    bool begin_run() {
+        uint64_t s = state.load(std::memory_order_acquire);
+        while ((s & kStatusMask) == kPending || (s & kStatusMask) == kDue) {
+            if (state.compare_exchange_weak(s, (s & ~kStatusMask) | kRunning, std::memory_order_acq_rel,
+                                            std::memory_order_acquire)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 計時器到期: Pending → Due，之後就不能再改期。改期命令在途中 (Moving) 時回傳 false，
+    // 節點留在時間輪裡等命令決定新的時間；已取消的照常交出去，由 execute 回收
+    bool try_mark_due() {
+        uint64_t s = state.load(std::memory_order_acquire);
+        while ((s & kStatusMask) == kPending) {
+            if (state.compare_exchange_weak(s, (s & ~kStatusMask) | kDue, std::memory_order_acq_rel,
+                                            std::memory_order_acquire)) {
+                return true;
+            }
+        }
+        return (s & kStatusMask) != kMoving;
+    }
+
+    // 改期: Pending → Moving (已經是 Moving 也算成功，最後送達的命令為準)；
+    // generation 不符、已到期、執行中或已取消都回傳 false
+    bool try_begin_move(uint64_t gen) {
+        uint64_t s = state.load(std::memory_order_acquire);
+        while ((s >> kGenerationShift) == gen) {
+            uint64_t status = s & kStatusMask;
+            if (status == kMoving) {
+                return true;
+            }
+            if (status != kPending) {
+                return false;
+            }
+            if (state.compare_exchange_weak(s, (s & ~kStatusMask) | kMoving, std::memory_order_acq_rel,
+                                            std::memory_order_acquire)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 改期命令送達: Moving → Pending；途中被取消了就回傳 false
+    bool end_move() {
+        uint64_t s = state.load(std::memory_order_acquire);
+        while ((s & kStatusMask) == kMoving) {
+            if (state.compare_exchange_weak(s, s & ~kStatusMask, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                return true;
+            }
+        }
+        return (s & kStatusMask) == kPending;
+    }
+
+    // 週期任務跑完: Running → Pending；執行中被取消了就回傳 false
+    bool end_periodic_run() {
+        uint64_t s = state.load(std::memory_order_acquire);
+        return (s & kStatusMask) == kRunning &&
+               state.compare_exchange_strong(s, s & ~kStatusMask, std::memory_order_acq_rel, std::memory_order_acquire);
+    }
+
+    // 只有 generation 相符、而且還沒開始執行 (週期任務則是還沒取消) 才會成功
+    bool try_cancel(uint64_t gen, bool& was_pending) {
+        uint64_t s = state.load(std::memory_order_acquire);
+        while ((s >> kGenerationShift) == gen) {
+            uint64_t status = s & kStatusMask;
+            if (status == kCancelled || (status == kRunning && !(s & kPeriodic))) {
+                return false;
+            }
+            if (state.compare_exchange_weak(s, (s & ~kStatusMask) | kCancelled, std::memory_order_acq_rel,
+                                            std::memory_order_acquire)) {
+                was_pending = status == kPending || status == kMoving; // 還在時間輪裡
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool cancelled() const { return (state.load(std::memory_order_acquire) & kStatusMask) == kCancelled; }
+};
+
+// rank 小的先執行 (std::priority_queue 是 max-heap，所以反過來比)
+struct ReadyTaskCompare {
+    bool operator()(const TaskNode* a, const TaskNode* b) const {
+        return a->rank > b->rank;
+    }
+};
+
+// TaskNode 的 free list；任何執行緒都可以 acquire / release
+class TaskNodePool {
+private:
+    static const size_t kChunkSize = 256;
+
+    std::mutex mtx_;
+    TaskNode* free_ = nullptr;
+    std::vector<std::unique_ptr<TaskNode[]>> chunks_;
+
+public:
+    TaskNodePool() = default;
+    TaskNodePool(const TaskNodePool&) = delete;
+    TaskNodePool& operator=(const TaskNodePool&) = delete;
+
+    TaskNode* acquire() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (!free_) {
+            chunks_.emplace_back(new TaskNode[kChunkSize]);
+            TaskNode* chunk = chunks_.back().get();
+            for (size_t i = 0; i < kChunkSize; ++i) {
+                chunk[i].next = free_;
+                free_ = &chunk[i];
+            }
+        }
+        TaskNode* node = free_;
+        free_ = node->next;
+        node->next = nullptr;
+        return node;
+    }
+
+    // 先解構 callable (釋放 capture 的資源)，generation 加一讓舊 handle 失效，再放回 free list
+    // level / slot 不在這裡重設: 離開時間輪時已經是 -1，而 run() 的執行緒可能正在讀
+    void release(TaskNode* node) {
+        node->task.func.reset();
+        node->delayed = false;
+        node->has_deadline = false;
+        node->kind = TaskNode::kTask;
+        node->period = std::chrono::steady_clock::duration(0);
+        node->target = nullptr;
+        node->prev = nullptr;
+        uint64_t gen = node->state.load(std::memory_order_relaxed) >> TaskNode::kGenerationShift;
+        node->state.store((gen + 1) << TaskNode::kGenerationShift, std::memory_order_release);
+        std::lock_guard<std::mutex> lock(mtx_);
+        node->next = free_;
+        free_ = node;
+    }
+};
+
+class TimingWheel {
+public:
+    static const int kLevels = 4;
+    static const int kSlotBits = 8;
+    static const int kSlots = 1 << kSlotBits;
+
+private:
+    static const uint64_t kSlotMask = kSlots - 1;
+    static const int kWords = kSlots / 64;
+
+    TaskNode* slots_[kLevels][kSlots] = {};
+    uint64_t occupied_[kLevels][kWords] = {};
+    uint64_t current_tick_ = 0;
+    size_t size_ = 0;
+
+    // 找 level 中 index >= from 的第一個有節點的格子，沒有回傳 -1
+    int find_occupied(int level, int from) const {
+        for (int word = from / 64; word < kWords; ++word) {
+            uint64_t bits = occupied_[level][word];
+            if (word == from / 64) {
+                bits &= ~0ULL << (from % 64);
+            }
+            if (bits != 0) {
+                return word * 64 + __builtin_ctzll(bits);
+            }
+        }
+        return -1;
+    }
+
+    // 依照到期 tick 與目前 tick 的距離放到對應層的格子 (允許 expire_tick == current_tick_)
+    void place(TaskNode* node) {
+        uint64_t delta = node->expire_tick - current_tick_;
+        uint64_t target = node->expire_tick;
+        int level = 0;
+        while (level < kLevels - 1 && delta >= (1ULL << (kSlotBits * (level + 1)))) {
+            ++level;
+        }
+        if (delta >= (1ULL << (kSlotBits * kLevels))) {
+            // 超出時間輪範圍: 先放在最高層最遠的格子，cascade 時會再重新分配
+            target = current_tick_ + (1ULL << (kSlotBits * kLevels)) - 1;
+        }
+        int slot = static_cast<int>((target >> (kSlotBits * level)) & kSlotMask);
+
+        node->level = level;
+        node->slot = slot;
+        node->prev = nullptr;
+        node->next = slots_[level][slot];
+        if (node->next) {
+            node->next->prev = node;
+        }
+        slots_[level][slot] = node;
+        occupied_[level][slot / 64] |= 1ULL << (slot % 64);
+    }
+
+    // 把一整格拔下來，回傳串列的頭
+    TaskNode* detach_slot(int level, int slot) {
+        TaskNode* head = slots_[level][slot];
+        slots_[level][slot] = nullptr;
+        occupied_[level][slot / 64] &= ~(1ULL << (slot % 64));
+        return head;
+    }
+
+    // tick 跨過上層的邊界時，由上而下把對應的格子重新分配
+    void cascade(uint64_t tick) {
+        for (int level = kLevels - 1; level >= 1; --level) {
+            if ((tick & ((1ULL << (kSlotBits * level)) - 1)) != 0) {
+                continue;
+            }
+            int slot = static_cast<int>((tick >> (kSlotBits * level)) & kSlotMask);
+            TaskNode* node = detach_slot(level, slot);
+            while (node) {
+                TaskNode* next = node->next;
+                place(node);
+                node = next;
+            }
+        }
+    }
+
+public:
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+    uint64_t current_tick() const { return current_tick_; }
+
+    // O(1) 插入；已經到期的節點會放到下一個 tick
+    void insert(TaskNode* node) {
+        if (node->expire_tick <= current_tick_) {
+            node->expire_tick = current_tick_ + 1;
+        }
+        place(node);
+        ++size_;
+    }
+
+    // O(1) 取消
+    void remove(TaskNode* node) {
+        if (node->prev) {
+            node->prev->next = node->next;
+        } else {
+            slots_[node->level][node->slot] = node->next;
+            if (!node->next) {
+                occupied_[node->level][node->slot / 64] &= ~(1ULL << (node->slot % 64));
+            }
+        }
+        if (node->next) {
+            node->next->prev = node->prev;
+        }
+        node->prev = node->next = nullptr;
+        node->level = node->slot = -1;
+        --size_;
+    }
+
+    // 推進到 target_tick，每個到期的節點都交給 on_expire (節點的所有權一併交出)
+    template <typename F>
+    void advance_to(uint64_t target_tick, F&& on_expire) {
+        while (current_tick_ < target_tick && size_ > 0) {
+            int index = static_cast<int>(current_tick_ & kSlotMask);
+            uint64_t base = current_tick_ - index;
+            int next_slot = index + 1 < kSlots ? find_occupied(0, index + 1) : -1;
+            uint64_t next_tick = next_slot >= 0 ? base + next_slot : base + kSlots;
+            if (next_tick > target_tick) {
+                break;
+            }
+
+            current_tick_ = next_tick;
+            if ((current_tick_ & kSlotMask) == 0) {
+                cascade(current_tick_);
+            }
+            TaskNode* node = detach_slot(0, static_cast<int>(current_tick_ & kSlotMask));
+            while (node) {
+                TaskNode* next = node->next;
+                node->prev = node->next = nullptr;
+                node->level = node->slot = -1;
+                --size_;
+                on_expire(node);
+                node = next;
+            }
+        }
+        if (current_tick_ < target_tick) {
+            current_tick_ = target_tick;
+        }
+    }
+
+    // 下一個需要處理的 tick (可能只是 cascade 的邊界)；沒有節點時回傳 false
+    bool next_tick(uint64_t& out) const {
+        if (size_ == 0) {
+            return false;
+        }
+        int index = static_cast<int>(current_tick_ & kSlotMask);
+        uint64_t base = current_tick_ - index;
+        int next_slot = index + 1 < kSlots ? find_occupied(0, index + 1) : -1;
+        out = next_slot >= 0 ? base + next_slot : base + kSlots;
+        return true;
+    }
+
+    // 拔掉所有節點 (解構時用)
+    template <typename F>
+    void clear(F&& on_node) {
+        for (int level = 0; level < kLevels; ++level) {
+            for (int slot = 0; slot < kSlots; ++slot) {
+                TaskNode* node = detach_slot(level, slot);
+                while (node) {
+                    TaskNode* next = node->next;
+                    on_node(node);
+                    node = next;
+                }
+            }
+        }
+        size_ = 0;
+    }
+};
+
+// Chase-Lev work-stealing deque (Lê et al., "Correct and Efficient Work-Stealing for Weak Memory Models")
+template <typename T>
+class ChaseLevDeque {
+private:
+    struct Array {
+        int64_t capacity;
+        std::unique_ptr<std::atomic<T*>[]> slots;
+
+        explicit Array(int64_t cap) : capacity(cap), slots(new std::atomic<T*>[cap]) {}
+        T* get(int64_t i) const { return slots[i & (capacity - 1)].load(std::memory_order_relaxed); }
+        void put(int64_t i, T* x) { slots[i & (capacity - 1)].store(x, std::memory_order_relaxed); }
+    };
+
+    std::atomic<int64_t> top_{0};
+    std::atomic<int64_t> bottom_{0};
+    std::atomic<Array*> array_;
+    std::vector<std::unique_ptr<Array>> arrays_; // 所有用過的陣列，解構時才釋放 (只有擁有者會動)
+
+    Array* grow(Array* old, int64_t bottom, int64_t top) {
+        arrays_.emplace_back(new Array(old->capacity * 2));
+        Array* bigger = arrays_.back().get();
+        for (int64_t i = top; i < bottom; ++i) {
+            bigger->put(i, old->get(i));
+        }
+        array_.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+
+public:
+    // 預設容量要蓋過常見的突發量，否則穩態下偶爾還是會因為 grow 而配置
+    explicit ChaseLevDeque(int64_t capacity = 1024) {
+        arrays_.emplace_back(new Array(capacity));
+        array_.store(arrays_.back().get(), std::memory_order_relaxed);
+    }
+
+    // 只有擁有者可以呼叫
+    void push(T* x) {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        Array* a = array_.load(std::memory_order_relaxed);
+        if (b - t > a->capacity - 1) {
+            a = grow(a, b, t);
+        }
+        a->put(b, x);
+        // 用 release store 而不是 release fence + relaxed store: 效果相同，ThreadSanitizer 也看得懂
+        bottom_.store(b + 1, std::memory_order_release);
+    }
+
+    // 只有擁有者可以呼叫，空的時候回傳 nullptr
+    T* pop() {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        Array* a = array_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom_.store(b + 1, std::memory_order_release);
+            return nullptr;
+        }
+        T* x = a->get(b);
+        if (t == b) {
+            // 最後一個元素，可能同時被偷，用 CAS 決定誰拿到
+            if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                x = nullptr;
+            }
+            bottom_.store(b + 1, std::memory_order_release);
+        }
+        return x;
+    }
+
+    // 任何執行緒都可以呼叫，空的或搶輸時回傳 nullptr
+    T* steal() {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) {
+            return nullptr;
+        }
+        Array* a = array_.load(std::memory_order_acquire);
+        T* x = a->get(t);
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return x;
+    }
+};
+
+class WorkStealingExecutor {
+public:
+    static const int kPriorityBands = 4;
+
+    static int priority_band(int priority) {
+        return std::max(0, std::min(kPriorityBands - 1, priority / 10));
+    }
+
+private:
+    struct Worker {
+        ChaseLevDeque<TaskNode> deques[kPriorityBands];
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::function<void(TaskNode*)> run_node_;
+    std::function<void()> on_idle_;
+
+    // 外部執行緒提交的任務 (每個 band 一條 intrusive FIFO)
+    std::mutex inject_mtx_;
+    TaskNode* injected_head_[kPriorityBands] = {};
+    TaskNode* injected_tail_[kPriorityBands] = {};
+    std::atomic<int> injected_count_[kPriorityBands];
+
+    std::atomic<int64_t> queued_{0};      // 已提交、還沒被 worker 取走
+    std::atomic<int64_t> outstanding_{0}; // 已提交、還沒執行完
+    std::atomic<int> sleepers_{0};
+    std::atomic<bool> stop_{false};
+    std::mutex park_mtx_;
+    std::condition_variable park_cv_;
+
+    struct CurrentWorker {
+        const WorkStealingExecutor* owner = nullptr;
+        Worker* worker = nullptr;
+    };
+
+    static CurrentWorker& current_worker() {
+        thread_local CurrentWorker current;
+        return current;
+    }
+
+    TaskNode* take_injected(int band) {
+        if (injected_count_[band].load(std::memory_order_acquire) == 0) {
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock(inject_mtx_);
+        TaskNode* node = injected_head_[band];
+        if (!node) {
+            return nullptr;
+        }
+        injected_head_[band] = node->next;
+        if (!injected_head_[band]) {
+            injected_tail_[band] = nullptr;
+        }
+        node->next = nullptr;
+        injected_count_[band].fetch_sub(1, std::memory_order_release);
+        return node;
+    }
+
+    TaskNode* find_task(size_t self, std::mt19937& rng) {
+        Worker& me = *workers_[self];
+        for (int band = kPriorityBands - 1; band >= 0; --band) {
+            if (TaskNode* task = me.deques[band].pop()) {
+                return task;
+            }
+            if (TaskNode* task = take_injected(band)) {
+                return task;
+            }
+            size_t start = rng() % workers_.size();
+            for (size_t i = 0; i < workers_.size(); ++i) {
+                size_t victim = (start + i) % workers_.size();
+                if (victim == self) {
+                    continue;
+                }
+                if (TaskNode* task = workers_[victim]->deques[band].steal()) {
+                    return task;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    void worker_loop(size_t self) {
+        current_worker().owner = this;
+        current_worker().worker = workers_[self].get();
+        std::mt19937 rng(static_cast<unsigned>(self) + 1);
+
+        while (true) {
+            TaskNode* task = find_task(self, rng);
+            if (task) {
+                queued_.fetch_sub(1, std::memory_order_seq_cst);
+                run_node_(task);
+                if (outstanding_.fetch_sub(1, std::memory_order_acq_rel) == 1 && on_idle_) {
+                    on_idle_();
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(park_mtx_);
+            sleepers_.fetch_add(1, std::memory_order_seq_cst);
+            park_cv_.wait(lock, [this] {
+                return queued_.load(std::memory_order_seq_cst) > 0 || stop_.load(std::memory_order_relaxed);
+            });
+            sleepers_.fetch_sub(1, std::memory_order_relaxed);
+            if (stop_.load(std::memory_order_relaxed) && queued_.load(std::memory_order_seq_cst) == 0) {
+                return;
+            }
+        }
+    }
+
+public:
+    // run_node: 執行並處置一個節點 (回收或重新排程)
+    // on_idle: 每次「沒有待執行或執行中的任務」時呼叫 (在 worker 執行緒上)
+    WorkStealingExecutor(size_t threads, std::function<void(TaskNode*)> run_node,
+                         std::function<void()> on_idle = nullptr)
+        : run_node_(std::move(run_node)), on_idle_(std::move(on_idle)) {
+        for (int band = 0; band < kPriorityBands; ++band) {
+            injected_count_[band].store(0, std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < threads; ++i) {
+            workers_.emplace_back(new Worker);
+        }
+        for (size_t i = 0; i < threads; ++i) {
+            workers_[i]->thread = std::thread(&WorkStealingExecutor::worker_loop, this, i);
+        }
+    }
+
+    ~WorkStealingExecutor() {
+        {
+            std::lock_guard<std::mutex> lock(park_mtx_);
+            stop_.store(true, std::memory_order_relaxed);
+        }
+        park_cv_.notify_all();
+        for (auto& w : workers_) {
+            w->thread.join();
+        }
+    }
+
+    // 任何執行緒都可以提交；worker 上提交的任務進自己的 deque
+    void submit(TaskNode* task) {
+        outstanding_.fetch_add(1, std::memory_order_relaxed);
+        int band = priority_band(task->task.priority);
+        CurrentWorker& current = current_worker();
+        if (current.owner == this) {
+            current.worker->deques[band].push(task);
+        } else {
+            std::lock_guard<std::mutex> lock(inject_mtx_);
+            task->next = nullptr;
+            if (injected_tail_[band]) {
+                injected_tail_[band]->next = task;
+            } else {
+                injected_head_[band] = task;
+            }
+            injected_tail_[band] = task;
+            injected_count_[band].fetch_add(1, std::memory_order_release);
+        }
+
+        queued_.fetch_add(1, std::memory_order_seq_cst);
+        if (sleepers_.load(std::memory_order_seq_cst) > 0) {
+            std::lock_guard<std::mutex> lock(park_mtx_);
+            park_cv_.notify_one();
+        }
+    }
+
+    bool idle() const {
+        return outstanding_.load(std::memory_order_acquire) == 0;
+    }
+
+    size_t size() const { return workers_.size(); }
+};
+
+// HDR 風格的 log-linear histogram (單位 ns)；任何執行緒都可以 record
+class LatencyHistogram {
+public:
+    static const int kSubBits = 4;
+    static const int kSubBuckets = 1 << kSubBits;          // 每個 2 的次方區間切 16 格
+    static const int kMaxExponent = 40;                    // 2^40 ns ≈ 18 分鐘，更大的記在最後一格
+    static const int kBuckets = (kMaxExponent - kSubBits + 2) * kSubBuckets;
+
+    static int bucket_index(uint64_t value) {
+        if (value < static_cast<uint64_t>(kSubBuckets)) {
+            return static_cast<int>(value);
+        }
+        int exponent = 63 - __builtin_clzll(value);
+        if (exponent > kMaxExponent) {
+            return kBuckets - 1;
+        }
+        int sub = static_cast<int>((value >> (exponent - kSubBits)) & (kSubBuckets - 1));
+        return (exponent - kSubBits + 1) * kSubBuckets + sub;
+    }
+
+    // bucket 內最大的值 (回報 percentile 時用，跟 HDR 的 highest equivalent value 一樣)
+    static uint64_t bucket_upper(int index) {
+        if (index < kSubBuckets) {
+            return static_cast<uint64_t>(index);
+        }
+        int exponent = index / kSubBuckets + kSubBits - 1;
+        uint64_t sub = static_cast<uint64_t>(index % kSubBuckets);
+        uint64_t width = 1ULL << (exponent - kSubBits);
+        return ((kSubBuckets + sub) << (exponent - kSubBits)) + width - 1;
+    }
+
+private:
+    std::atomic<uint64_t> counts_[kBuckets];
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+
+public:
+    LatencyHistogram() { reset(); }
+
+    void record(uint64_t value) {
+        counts_[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+        uint64_t seen = max_.load(std::memory_order_relaxed);
+        while (value > seen && !max_.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    void reset() {
+        for (auto& count : counts_) {
+            count.store(0, std::memory_order_relaxed);
+        }
+        sum_.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+    friend class HistogramSnapshot;
+};
+
+// 某一刻的 histogram 複本，可以合併、查分位數
+class HistogramSnapshot {
+private:
+    std::vector<uint64_t> counts_;
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t max_ = 0;
+
+public:
+    HistogramSnapshot() : counts_(LatencyHistogram::kBuckets, 0) {}
+
+    explicit HistogramSnapshot(const LatencyHistogram& histogram) : HistogramSnapshot() {
+        for (int i = 0; i < LatencyHistogram::kBuckets; ++i) {
+            counts_[i] = histogram.counts_[i].load(std::memory_order_relaxed);
+            count_ += counts_[i];
+        }
+        sum_ = histogram.sum_.load(std::memory_order_relaxed);
+        max_ = histogram.max_.load(std::memory_order_relaxed);
+    }
+
+    void merge(const HistogramSnapshot& other) {
+        for (int i = 0; i < LatencyHistogram::kBuckets; ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        count_ += other.count_;
+        sum_ += other.sum_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    uint64_t count() const { return count_; }
+    uint64_t max() const { return max_; }
+    double mean() const { return count_ == 0 ? 0.0 : static_cast<double>(sum_) / count_; }
+
+    // percentile 介於 0~100；回傳該 bucket 的上界 (不超過實際最大值)
+    uint64_t percentile(double percentile) const {
+        if (count_ == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * count_ + 0.5);
+        rank = std::max<uint64_t>(1, std::min(rank, count_));
+        uint64_t seen = 0;
+        for (int i = 0; i < LatencyHistogram::kBuckets; ++i) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                return std::min(LatencyHistogram::bucket_upper(i), max_);
+            }
+        }
+        return max_;
+    }
+};
+
+struct TaskMetricsSnapshot {
+    HistogramSnapshot lateness;   // 延遲任務: 實際開始 - wake_time
+    HistogramSnapshot queue_wait; // 可以執行 → 開始執行
+    HistogramSnapshot execution;  // 執行時間
+
+    void merge(const TaskMetricsSnapshot& other) {
+        lateness.merge(other.lateness);
+        queue_wait.merge(other.queue_wait);
+        execution.merge(other.execution);
+    }
+};
+
+struct SchedulerMetricsSnapshot {
+    TaskMetricsSnapshot total;
+    TaskMetricsSnapshot by_band[WorkStealingExecutor::kPriorityBands]; // priority / 10，同 executor 的 band
+
+    // 截止時間任務 (不受 set_metrics 影響)
+    uint64_t deadline_met = 0;
+    uint64_t deadline_missed = 0;
+    HistogramSnapshot deadline_overshoot; // 超過 deadline 多少
+};
+
+class TaskScheduler;
+
+// run_task_after / run_every 回傳的 handle，可以任意複製，任何執行緒都可以呼叫
+class TaskHandle {
+private:
+    TaskScheduler* scheduler_ = nullptr;
+    TaskNode* node_ = nullptr;
+    uint64_t generation_ = 0;
+
+    friend class TaskScheduler;
+    TaskHandle(TaskScheduler* scheduler, TaskNode* node, uint64_t generation)
+        : scheduler_(scheduler), node_(node), generation_(generation) {}
+
+public:
+    TaskHandle() = default;
+
+    // 任務還沒開始執行 (週期任務: 還沒被取消) 時成功
+    bool cancel();
+
+    // 改成從現在起 delay 之後到期；計時器已經到期 (即使還沒開始執行)、執行中、已取消或 handle 過期時回傳 false
+    bool reschedule(std::chrono::milliseconds delay);
+
+    explicit operator bool() const { return node_ != nullptr; }
+};
+
+#if TASK_SCHEDULER_HAS_COROUTINES
+// coroutine frame 的配置器: 依 64 bytes 分級的 free list，frame 可能在任何執行緒配置或釋放
+class CoroutineFramePool {
+private:
+    static const size_t kGranularity = 64;
+    static const size_t kClasses = 16; // 最大 1 KiB
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    std::mutex mtx_;
+    FreeBlock* free_[kClasses] = {};
+    size_t blocks_ = 0; // 向系統要過的區塊數
+
+    static size_t size_class(size_t size) { return size == 0 ? 0 : (size - 1) / kGranularity; }
+
+    CoroutineFramePool() = default;
+
+public:
+    ~CoroutineFramePool() {
+        for (FreeBlock*& head : free_) {
+            while (head) {
+                FreeBlock* next = head->next;
+                ::operator delete(head);
+                head = next;
+            }
+        }
+    }
+
+    static CoroutineFramePool& instance() {
+        static CoroutineFramePool pool;
+        return pool;
+    }
+
+    void* allocate(size_t size) {
+        size_t cls = size_class(size);
+        if (cls >= kClasses) {
+            return ::operator new(size);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (FreeBlock* block = free_[cls]) {
+                free_[cls] = block->next;
+                return block;
+            }
+            ++blocks_;
+        }
+        return ::operator new((cls + 1) * kGranularity);
+    }
+
+    void deallocate(void* p, size_t size) {
+        size_t cls = size_class(size);
+        if (cls >= kClasses) {
+            ::operator delete(p);
+            return;
+        }
+        FreeBlock* block = static_cast<FreeBlock*>(p);
+        std::lock_guard<std::mutex> lock(mtx_);
+        block->next = free_[cls];
+        free_[cls] = block;
+    }
+
+    size_t blocks() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return blocks_;
+    }
+};
+
+// fire-and-forget 協程: 交給 TaskScheduler::spawn 之後才開始跑，跑完自己釋放 frame
+class CoTask {
+public:
+    struct promise_type {
+        int priority = 0;
+
+        CoTask get_return_object() { return CoTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+
+        static void* operator new(size_t size) { return CoroutineFramePool::instance().allocate(size); }
+        static void operator delete(void* p, size_t size) { CoroutineFramePool::instance().deallocate(p, size); }
+    };
+
+    CoTask(CoTask&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    CoTask& operator=(CoTask&&) = delete;
+
+    // 沒有被 spawn 的協程由這裡釋放
+    ~CoTask() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+private:
+    friend class TaskScheduler;
+    explicit CoTask(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+// co_await sched.sleep_for(d): 透過時間輪在 d 之後 resume
+struct SleepAwaiter {
+    TaskScheduler* scheduler;
+    std::chrono::milliseconds delay;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<CoTask::promise_type> handle);
+    void await_resume() const noexcept {}
+};
+
+// co_await sched.yield(): 排到 ready queue 的尾端，讓同優先權以上的任務先跑
+struct YieldAwaiter {
+    TaskScheduler* scheduler;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<CoTask::promise_type> handle);
+    void await_resume() const noexcept {}
+};
+#endif
+
+// 任務相依圖: 先 add_node / add_edge 建好，交給 TaskScheduler::submit 執行；跑完可以再 submit
+class TaskGraph {
+public:
+    using NodeId = size_t;
+
+private:
+    struct Node {
+        TaskCallable func;
+        int priority;
+        std::vector<NodeId> successors;
+        int predecessors = 0;
+        std::atomic<int> pending{0}; // 這一輪還沒做完的前驅
+    };
+
+    std::deque<Node> nodes_;
+    std::vector<int> scratch_; // 檢查環用
+    bool validated_ = false;
+
+    std::atomic<size_t> remaining_{0};
+    std::atomic<bool> running_{false};
+    std::mutex done_mtx_;
+    std::condition_variable done_cv_;
+
+    friend class TaskScheduler;
+
+    // 檢查有沒有環 (Kahn's algorithm)，只有拓撲變動過才需要
+    void validate() {
+        if (validated_) {
+            return;
+        }
+        scratch_.assign(nodes_.size(), 0);
+        std::vector<NodeId> ready;
+        for (NodeId id = 0; id < nodes_.size(); ++id) {
+            scratch_[id] = nodes_[id].predecessors;
+            if (scratch_[id] == 0) {
+                ready.push_back(id);
+            }
+        }
+        size_t visited = 0;
+        while (!ready.empty()) {
+            NodeId id = ready.back();
+            ready.pop_back();
+            ++visited;
+            for (NodeId next : nodes_[id].successors) {
+                if (--scratch_[next] == 0) {
+                    ready.push_back(next);
+                }
+            }
+        }
+        if (visited != nodes_.size()) {
+            throw std::invalid_argument("TaskGraph contains a cycle");
+        }
+        validated_ = true;
+    }
+
+    void finish() {
+        std::lock_guard<std::mutex> lock(done_mtx_);
+        running_.store(false, std::memory_order_release);
+        done_cv_.notify_all();
+    }
+
+public:
+    TaskGraph() = default;
+    TaskGraph(const TaskGraph&) = delete;
+    TaskGraph& operator=(const TaskGraph&) = delete;
+
+    template <typename F>
+    NodeId add_node(int priority, F&& func) {
+        if (running()) {
+            throw std::logic_error("TaskGraph cannot be modified while running");
+        }
+        nodes_.emplace_back();
+        nodes_.back().func = TaskCallable(std::forward<F>(func));
+        nodes_.back().priority = priority;
+        validated_ = false;
+        return nodes_.size() - 1;
+    }
+
+    // before 做完之後 after 才能開始
+    void add_edge(NodeId before, NodeId after) {
+        if (before >= nodes_.size() || after >= nodes_.size()) {
+            throw std::out_of_range("TaskGraph node id out of range");
+        }
+        if (running()) {
+            throw std::logic_error("TaskGraph cannot be modified while running");
+        }
+        nodes_[before].successors.push_back(after);
+        ++nodes_[after].predecessors;
+        validated_ = false;
+    }
+
+    size_t size() const { return nodes_.size(); }
+    bool running() const { return running_.load(std::memory_order_acquire); }
+
+    // 等這一輪跑完 (不要在 run() 的執行緒或 worker 上呼叫)
+    void wait() {
+        std::unique_lock<std::mutex> lock(done_mtx_);
+        done_cv_.wait(lock, [this] { return !running(); });
+    }
+};
+
+class TaskScheduler {
+private:
+    friend class TaskHandle;
+
+    TaskNodePool pool_; // 必須比 executor_ 晚解構
+
+    // 以下只由 run() 的執行緒存取
+    std::priority_queue<TaskNode*, std::vector<TaskNode*>, ReadyTaskCompare> ready_queue_;
+    TimingWheel delayed_wheel_;
+    const std::chrono::steady_clock::duration tick_;
+    const TimePoint origin_;
+    std::unique_ptr<WorkStealingExecutor> executor_;
+
+    // 任何執行緒都可以 push 的提交佇列 (MPSC)
+    std::atomic<TaskNode*> submissions_{nullptr};
+
+    // 閒置時 park 用
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::atomic<bool> sleeping_{false};
+    std::atomic<bool> stop_{false};
+    bool trace_ = true; // 是否印出延遲任務到期的訊息
+    bool metrics_ = true;
+
+    struct BandMetrics {
+        LatencyHistogram lateness;
+        LatencyHistogram queue_wait;
+        LatencyHistogram execution;
+    };
+    BandMetrics metrics_by_band_[WorkStealingExecutor::kPriorityBands];
+    std::atomic<uint64_t> deadline_met_{0};
+    std::atomic<uint64_t> deadline_missed_{0};
+    LatencyHistogram deadline_overshoot_;
+
+    int64_t aging_quantum_ns_ = 100 * 1000 * 1000;
+
+    int64_t since_origin_ns(TimePoint t) const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(t - origin_).count();
+    }
+
+    static uint64_t elapsed_ns(TimePoint from, TimePoint to) {
+        return to <= from ? 0 : static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count());
+    }
+
+    uint64_t tick_floor(TimePoint t) const {
+        return t <= origin_ ? 0 : static_cast<uint64_t>((t - origin_) / tick_);
+    }
+
+    uint64_t tick_ceil(TimePoint t) const {
+        if (t <= origin_) {
+            return 0;
+        }
+        auto elapsed = t - origin_;
+        return static_cast<uint64_t>((elapsed + tick_ - std::chrono::steady_clock::duration(1)) / tick_);
+    }
+
+    void submit(TaskNode* node) {
+        TaskNode* head = submissions_.load(std::memory_order_relaxed);
+        do {
+            node->next = head;
+        } while (!submissions_.compare_exchange_weak(head, node, std::memory_order_seq_cst,
+                                                     std::memory_order_relaxed));
+        if (sleeping_.load(std::memory_order_seq_cst)) {
+            std::lock_guard<std::mutex> lock(mtx_);
+            cv_.notify_one();
+        }
+    }
 
-struct Task {
-    int priority;
-    std::function<void()> func;
-    TimePoint wake_time;
+    // 執行一個節點: 已取消的直接回收；週期任務排下一次，其餘回收
+    void execute(TaskNode* node) {
+        if (!node->begin_run()) {
+            pool_.release(node);
+            return;
+        }
+        if (metrics_ || node->has_deadline) {
+            BandMetrics& band = metrics_by_band_[WorkStealingExecutor::priority_band(node->task.priority)];
+            TimePoint start = std::chrono::steady_clock::now();
+            if (metrics_) {
+                if (node->delayed) {
+                    band.lateness.record(elapsed_ns(node->task.wake_time, start));
+                }
+                band.queue_wait.record(elapsed_ns(node->ready_time, start));
+            }
+            node->task.func();
+            TimePoint end = std::chrono::steady_clock::now();
+            if (metrics_) {
+                band.execution.record(elapsed_ns(start, end));
+            }
+            if (node->has_deadline) {
+                if (end > node->deadline) {
+                    deadline_missed_.fetch_add(1, std::memory_order_relaxed);
+                    deadline_overshoot_.record(elapsed_ns(node->deadline, end));
+                } else {
+                    deadline_met_.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        } else {
+            node->task.func();
+        }
+        if (node->period.count() > 0 && node->end_periodic_run()) {
+            // 以預定時間為基準 (不是執行完的時間)，落後的次數直接跳過
+            TimePoint now = std::chrono::steady_clock::now();
+            node->task.wake_time += node->period;
+            if (node->task.wake_time < now) {
+                node->task.wake_time += ((now - node->task.wake_time) / node->period + 1) * node->period;
+            }
+            node->delayed = true;
+            submit(node);
+            return;
+        }
+        pool_.release(node);
+    }
 
-    bool operator<(const Task& other) const {
-        return priority < other.priority;
+    void schedule_graph_node(TaskGraph* graph, TaskGraph::NodeId id) {
+        add_task(graph->nodes_[id].priority, [this, graph, id] { run_graph_node(graph, id); });
     }
-};
 
-struct DelayedTaskCompare {
-    bool operator()(const Task& a, const Task& b) const {
-        return a.wake_time > b.wake_time;
+    // 做完一個節點: 把前驅都做完的後繼排進去，最後一個節點負責宣告整張圖結束
+    void run_graph_node(TaskGraph* graph, TaskGraph::NodeId id) {
+        TaskGraph::Node& node = graph->nodes_[id];
+        node.func();
+        for (TaskGraph::NodeId next : node.successors) {
+            if (graph->nodes_[next].pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                schedule_graph_node(graph, next);
+            }
+        }
+        if (graph->remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            graph->finish();
+        }
     }
-};
 
-class TaskScheduler {
-private:
-    std::priority_queue<Task> ready_queue_;
-    std::priority_queue<Task, std::vector<Task>, DelayedTaskCompare> delayed_queue_;
+    // 取消 / 改期命令 (run() 的執行緒上)；目標不在時間輪裡 (已到期或已回收) 就什麼都不做
+    void apply_command(TaskNode* command) {
+        TaskNode* target = command->target;
+        if (target->level >= 0 && target->generation() == command->target_generation) {
+            if (command->kind == TaskNode::kCancelCommand) {
+                if (target->cancelled()) {
+                    delayed_wheel_.remove(target);
+                    pool_.release(target);
+                }
+            } else if (target->end_move()) {
+                delayed_wheel_.remove(target);
+                target->task.wake_time = command->task.wake_time;
+                schedule_delayed(target);
+            }
+        }
+        pool_.release(command);
+    }
 
-public:
-    void add_task(int priority, std::function<void()> func) {
-        ready_queue_.push({priority, func, {}});
+    void send_command(TaskNode::Kind kind, TaskNode* target, uint64_t generation, TimePoint wake_time) {
+        TaskNode* command = pool_.acquire();
+        command->kind = kind;
+        command->target = target;
+        command->target_generation = generation;
+        command->task.wake_time = wake_time;
+        submit(command);
+    }
+
+    bool cancel_node(TaskNode* node, uint64_t generation) {
+        bool was_pending = false;
+        if (!node->try_cancel(generation, was_pending)) {
+            return false;
+        }
+        if (was_pending) {
+            send_command(TaskNode::kCancelCommand, node, generation, TimePoint());
+        }
+        return true;
     }
 
-    void run_task_after(std::chrono::milliseconds delay, int priority, std::function<void()> func) {
-        TimePoint wake_time = std::chrono::steady_clock::now() + delay;
-        delayed_queue_.push({priority, func, wake_time});
+    bool reschedule_node(TaskNode* node, uint64_t generation, std::chrono::milliseconds delay) {
+        if (!node->try_begin_move(generation)) {
+            return false;
+        }
+        send_command(TaskNode::kRescheduleCommand, node, generation, std::chrono::steady_clock::now() + delay);
+        return true;
     }
 
-    void run() {
-        std::cout << "[Scheduler Start]" << std::endl;
-        while (!ready_queue_.empty() || !delayed_queue_.empty()) {
-            auto now = std::chrono::steady_clock::now();
+    void schedule_delayed(TaskNode* node) {
+        node->expire_tick = tick_ceil(node->task.wake_time);
+        if (node->expire_tick <= delayed_wheel_.current_tick() && node->try_mark_due()) {
+            make_ready(node);
+        } else {
+            delayed_wheel_.insert(node);
+        }
+    }
 
-            while (!delayed_queue_.empty() && delayed_queue_.top().wake_time <= now) {
-                Task task = delayed_queue_.top();
-                delayed_queue_.pop();
-                std::cout << "[Scheduler] A delayed task is now ready." << std::endl;
-                ready_queue_.push(task);
+    // 任務可以執行了: 單執行緒模式算好 rank 進 ready_queue_，executor 模式交給 worker
+    void make_ready(TaskNode* node) {
+        if (metrics_ && node->delayed) {
+            node->ready_time = std::chrono::steady_clock::now();
+        }
+        if (executor_) {
+            executor_->submit(node);
+            return;
+        }
+        if (node->has_deadline) {
+            node->rank = since_origin_ns(node->deadline);
+        } else {
+            TimePoint ready = node->delayed ? node->task.wake_time : node->ready_time;
+            node->rank = aged_rank(since_origin_ns(ready), node->task.priority, aging_quantum_ns_);
+        }
+        ready_queue_.push(node);
+    }
+
+    // 一次拿走整串提交，反轉成 FIFO 後分派
+    void drain_submissions() {
+        if (submissions_.load(std::memory_order_relaxed) == nullptr) {
+            return;
+        }
+        TaskNode* node = submissions_.exchange(nullptr, std::memory_order_acquire);
+        TaskNode* fifo = nullptr;
+        while (node) {
+            TaskNode* next = node->next;
+            node->next = fifo;
+            fifo = node;
+            node = next;
+        }
+        while (fifo) {
+            TaskNode* next = fifo->next;
+            fifo->next = nullptr;
+            if (fifo->kind != TaskNode::kTask) {
+                apply_command(fifo);
+            } else if (fifo->cancelled()) {
+                pool_.release(fifo);
+            } else if (fifo->delayed) {
+                schedule_delayed(fifo);
+            } else {
+                make_ready(fifo);
             }
+            fifo = next;
+        }
+    }
+
+    bool idle() const {
+        return ready_queue_.empty() && delayed_wheel_.empty() &&
+               submissions_.load(std::memory_order_acquire) == nullptr && (!executor_ || executor_->idle());
+    }
+
+    // 沒事做時睡到下一個到期 tick、新的提交或 stop()
+    void park(bool exit_when_idle) {
+        uint64_t next = 0;
+        bool has_deadline = delayed_wheel_.next_tick(next);
+        auto should_wake = [this, exit_when_idle] {
+            return submissions_.load(std::memory_order_seq_cst) != nullptr || stop_.load(std::memory_order_relaxed) ||
+                   (exit_when_idle && idle());
+        };
+
+        std::unique_lock<std::mutex> lock(mtx_);
+        sleeping_.store(true, std::memory_order_seq_cst);
+        if (has_deadline) {
+            cv_.wait_until(lock, origin_ + next * tick_, should_wake);
+        } else {
+            cv_.wait(lock, should_wake);
+        }
+        sleeping_.store(false, std::memory_order_relaxed);
+    }
+
+    void run_loop(bool exit_when_idle) {
+        while (true) {
+            drain_submissions();
+            delayed_wheel_.advance_to(tick_floor(std::chrono::steady_clock::now()), [this](TaskNode* node) {
+                if (!node->try_mark_due()) {
+                    delayed_wheel_.insert(node); // 改期命令在途中，下一輪 drain_submissions 會處理
+                    return;
+                }
+                if (trace_) {
+                    std::cout << "[Scheduler] A delayed task is now ready." << std::endl;
+                }
+                make_ready(node);
+            });
 
-            if (!ready_queue_.empty()) {
-                Task task = ready_queue_.top();
+            if (!executor_ && !ready_queue_.empty()) {
+                TaskNode* node = ready_queue_.top();
                 ready_queue_.pop();
-                task.func();
-            } else if (!delayed_queue_.empty()) {
-                std::this_thread::sleep_until(delayed_queue_.top().wake_time);
+                execute(node);
+                continue;
+            }
+
+            if (stop_.load(std::memory_order_relaxed) || (exit_when_idle && idle())) {
+                break;
+            }
+            park(exit_when_idle);
+        }
+    }
+
+public:
+    explicit TaskScheduler(std::chrono::steady_clock::duration tick = std::chrono::milliseconds(1),
+                           size_t worker_threads = 0)
+        : tick_(tick), origin_(std::chrono::steady_clock::now()) {
+        if (worker_threads > 0) {
+            executor_.reset(new WorkStealingExecutor(worker_threads, [this](TaskNode* node) { execute(node); }, [this] {
+                std::lock_guard<std::mutex> lock(mtx_);
+                cv_.notify_all();
+            }));
+        }
+    }
+
+    // 剩下的節點都屬於 pool_，跟著 pool_ 一起釋放
+    ~TaskScheduler() {
+        executor_.reset();
+    }
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    // 大量任務的測試關掉到期訊息 (run() 開始前設定)
+    void set_trace(bool enabled) { trace_ = enabled; }
+
+    // 開關 lateness / queue wait / execution 的量測 (提交任務前設定)
+    void set_metrics(bool enabled) { metrics_ = enabled; }
+
+    // priority >= kTopPriority 的任務相當於「ready 的當下就到期」；截止時間任務在 executor 裡也用這個 band
+    static const int kTopPriority = 40;
+
+    // priority p 的任務視為相對截止時間 (kTopPriority - p) x quantum (單位不拘，ns 或模擬用的 us 都可以)
+    static int64_t aged_rank(int64_t ready, int priority, int64_t quantum) {
+        return ready + static_cast<int64_t>(kTopPriority - priority) * quantum;
+    }
+
+    // 每等 quantum 相當於 priority 加一 (run() 開始前設定)
+    void set_aging_quantum(std::chrono::steady_clock::duration quantum) {
+        aging_quantum_ns_ = std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::nanoseconds>(quantum).count());
+    }
+
+    // 任何執行緒都可以呼叫；執行中取的快照各 histogram 之間不保證是同一瞬間
+    SchedulerMetricsSnapshot metrics_snapshot() const {
+        SchedulerMetricsSnapshot snapshot;
+        for (int band = 0; band < WorkStealingExecutor::kPriorityBands; ++band) {
+            TaskMetricsSnapshot& out = snapshot.by_band[band];
+            out.lateness = HistogramSnapshot(metrics_by_band_[band].lateness);
+            out.queue_wait = HistogramSnapshot(metrics_by_band_[band].queue_wait);
+            out.execution = HistogramSnapshot(metrics_by_band_[band].execution);
+            snapshot.total.merge(out);
+        }
+        snapshot.deadline_met = deadline_met_.load(std::memory_order_relaxed);
+        snapshot.deadline_missed = deadline_missed_.load(std::memory_order_relaxed);
+        snapshot.deadline_overshoot = HistogramSnapshot(deadline_overshoot_);
+        return snapshot;
+    }
+
+    void reset_metrics() {
+        for (BandMetrics& band : metrics_by_band_) {
+            band.lateness.reset();
+            band.queue_wait.reset();
+            band.execution.reset();
+        }
+        deadline_met_.store(0, std::memory_order_relaxed);
+        deadline_missed_.store(0, std::memory_order_relaxed);
+        deadline_overshoot_.reset();
+    }
+
+    // 任何執行緒都可以呼叫
+    template <typename F>
+    void add_task(int priority, F&& func) {
+        TaskNode* node = pool_.acquire();
+        node->task.priority = priority;
+        node->task.func = TaskCallable(std::forward<F>(func));
+        node->ready_time = std::chrono::steady_clock::now();
+        if (executor_) {
+            executor_->submit(node);
+            return;
+        }
+        submit(node);
+    }
+
+    // 最晚要在 deadline (從現在算起) 之前做完；單執行緒模式依 deadline 先後 (EDF) 執行
+    template <typename F>
+    void add_deadline_task(std::chrono::milliseconds deadline, F&& func) {
+        TaskNode* node = pool_.acquire();
+        node->task.priority = kTopPriority;
+        node->task.func = TaskCallable(std::forward<F>(func));
+        node->ready_time = std::chrono::steady_clock::now();
+        node->has_deadline = true;
+        node->deadline = node->ready_time + deadline;
+        if (executor_) {
+            executor_->submit(node);
+            return;
+        }
+        submit(node);
+    }
+
+    // 執行整張圖 (任何執行緒都可以呼叫)；graph 必須活到這一輪跑完
+    void submit(TaskGraph& graph) {
+        graph.validate();
+        if (graph.running_.exchange(true, std::memory_order_acq_rel)) {
+            throw std::logic_error("TaskGraph is already running");
+        }
+        if (graph.nodes_.empty()) {
+            graph.finish();
+            return;
+        }
+        for (TaskGraph::Node& node : graph.nodes_) {
+            node.pending.store(node.predecessors, std::memory_order_relaxed);
+        }
+        graph.remaining_.store(graph.nodes_.size(), std::memory_order_relaxed);
+        // 先重設完所有計數再排第一批 (add_task 的提交是 release，worker 看得到上面的 store)
+        for (TaskGraph::NodeId id = 0; id < graph.nodes_.size(); ++id) {
+            if (graph.nodes_[id].predecessors == 0) {
+                schedule_graph_node(&graph, id);
             }
         }
+    }
+
+    // 任何執行緒都可以呼叫
+    template <typename F>
+    TaskHandle run_task_after(std::chrono::milliseconds delay, int priority, F&& func) {
+        TaskNode* node = pool_.acquire();
+        node->task.priority = priority;
+        node->task.func = TaskCallable(std::forward<F>(func));
+        node->task.wake_time = std::chrono::steady_clock::now() + delay;
+        node->delayed = true;
+        TaskHandle handle(this, node, node->generation());
+        submit(node);
+        return handle;
+    }
+
+    // 每隔 period 執行一次 (第一次在 period 之後)，直到 handle 被 cancel；任何執行緒都可以呼叫
+    template <typename F>
+    TaskHandle run_every(std::chrono::milliseconds period, int priority, F&& func) {
+        TaskNode* node = pool_.acquire();
+        node->task.priority = priority;
+        node->task.func = TaskCallable(std::forward<F>(func));
+        node->task.wake_time = std::chrono::steady_clock::now() + period;
+        node->period = std::max(std::chrono::steady_clock::duration(period), std::chrono::steady_clock::duration(1));
+        node->delayed = true;
+        node->state.fetch_or(TaskNode::kPeriodic, std::memory_order_relaxed);
+        TaskHandle handle(this, node, node->generation());
+        submit(node);
+        return handle;
+    }
+
+    // 全部做完 (沒有待執行、延遲或提交中的任務) 就結束
+    void run() {
+        std::cout << "[Scheduler Start]" << std::endl;
+        run_loop(true);
         std::cout << "[Scheduler End]" << std::endl;
     }
+
+    // 一直服務到 stop() 被呼叫，閒置時 park 在 condition variable 上。
+    // 先呼叫了 stop() 的話立刻返回；返回時才清掉停止旗標，之後可以再 run_forever 一次
+    void run_forever() {
+        run_loop(false);
+        stop_.store(false, std::memory_order_relaxed);
+    }
+
+    // 任何執行緒都可以呼叫
+    void stop() {
+        stop_.store(true, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(mtx_);
+        cv_.notify_all();
+    }
+
+#if TASK_SCHEDULER_HAS_COROUTINES
+    // 把協程的第一次 resume 排進 ready queue；之後每次 co_await 都沿用這個優先權
+    void spawn(int priority, CoTask task) {
+        std::coroutine_handle<CoTask::promise_type> handle = std::exchange(task.handle_, nullptr);
+        handle.promise().priority = priority;
+        add_task(priority, [handle] { handle.resume(); });
+    }
+
+    SleepAwaiter sleep_for(std::chrono::milliseconds delay) { return SleepAwaiter{this, delay}; }
+    YieldAwaiter yield() { return YieldAwaiter{this}; }
+#endif
+};
+
+#if TASK_SCHEDULER_HAS_COROUTINES
+// 排程之後 handle 可能馬上在別的 worker 上 resume，所以先把需要的東西複製到區域變數
+inline void SleepAwaiter::await_suspend(std::coroutine_handle<CoTask::promise_type> handle) {
+    TaskScheduler* sched = scheduler;
+    std::chrono::milliseconds d = delay;
+    sched->run_task_after(d, handle.promise().priority, [handle] { handle.resume(); });
+}
+
+inline void YieldAwaiter::await_suspend(std::coroutine_handle<CoTask::promise_type> handle) {
+    TaskScheduler* sched = scheduler;
+    sched->add_task(handle.promise().priority, [handle] { handle.resume(); });
+}
+#endif
+
+inline bool TaskHandle::cancel() {
+    return node_ && scheduler_->cancel_node(node_, generation_);
+}
+
+inline bool TaskHandle::reschedule(std::chrono::milliseconds delay) {
+    return node_ && scheduler_->reschedule_node(node_, generation_, delay);
+}
+
+// --- 配置計數 (驗證穩態零配置用) ---
+static std::atomic<long> g_allocations{0};
+
+// 全域替換版本與 std::allocator 在同一個 TU，GCC 會把 inline 後的 new / free 誤判為不配對
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+// 一輪: 立即任務 + 短延遲任務 + 任務內再提交，全部跑完
+// 暖機要用比量測輪更大的 batch，ready queue 與 deque 的容量才一定夠量測輪的尖峰用
+long scheduling_round_allocations(TaskScheduler& scheduler, std::atomic<int>& counter, int batch) {
+    long before = g_allocations.load();
+    for (int i = 0; i < batch; ++i) {
+        int64_t payload[4] = {i, i + 1, i + 2, i + 3}; // 40 bytes 的 capture，std::function 會 heap 配置
+        scheduler.add_task(i % 30, [&scheduler, &counter, payload] {
+            counter.fetch_add(static_cast<int>(payload[1] - payload[0]), std::memory_order_relaxed);
+            scheduler.add_task(1, [&counter] { counter.fetch_add(1, std::memory_order_relaxed); });
+        });
+        scheduler.run_task_after(std::chrono::milliseconds(i % 5), i % 30, [&counter, payload] {
+            counter.fetch_add(static_cast<int>(payload[3] - payload[2]), std::memory_order_relaxed);
+        });
+    }
+    scheduler.run();
+    return g_allocations.load() - before;
+}
+
+void print_metrics_row(const char* name, const HistogramSnapshot& h) {
+    std::cout << "    " << name << ": n=" << h.count() << " p50=" << h.percentile(50) / 1000.0
+              << " us p99=" << h.percentile(99) / 1000.0 << " us max=" << h.max() / 1000.0 << " us" << std::endl;
+}
+
+void test_metrics() {
+    std::cout << "\n--- Lateness / Queue-Wait / Execution Histograms ---" << std::endl;
+
+    // histogram 本身: 1..1,000,000 的分位數相對誤差應該 < 1/16
+    LatencyHistogram histogram;
+    for (uint64_t v = 1; v <= 1000000; ++v) {
+        histogram.record(v);
+    }
+    HistogramSnapshot values(histogram);
+    bool accurate = true;
+    for (double p : {50.0, 90.0, 99.0, 99.9}) {
+        double expected = p / 100.0 * 1000000;
+        double error = (static_cast<double>(values.percentile(p)) - expected) / expected;
+        accurate = accurate && error > -1.0 / 16 && error < 1.0 / 16;
+    }
+    std::cout << "Histogram of 1..1e6: p50=" << values.percentile(50) << " p99=" << values.percentile(99)
+              << " max=" << values.max() << (accurate && values.max() == 1000000 ? " (passed)" : " (failed)")
+              << std::endl;
+
+    // 高優先權的長任務 (2 ms) 佔住執行緒，低優先權的短任務在 ready queue 裡等
+    TaskScheduler sched;
+    sched.set_trace(false);
+    std::mt19937 rng(7);
+    const int kDelayed = 300;
+    const int kLong = 20;
+    const int kShort = 200;
+    for (int i = 0; i < kDelayed; ++i) {
+        sched.run_task_after(std::chrono::milliseconds(1 + rng() % 60), 15, [] {});
+    }
+    for (int i = 0; i < kLong; ++i) {
+        sched.add_task(35, [] { std::this_thread::sleep_for(std::chrono::milliseconds(2)); });
+    }
+    for (int i = 0; i < kShort; ++i) {
+        sched.add_task(5, [] {});
+    }
+    sched.run();
+
+    SchedulerMetricsSnapshot snapshot = sched.metrics_snapshot();
+    const char* band_names[] = {"band 0 (prio 0-9)", "band 1 (prio 10-19)", "band 2 (prio 20-29)", "band 3 (prio 30+)"};
+    for (int band = 0; band < WorkStealingExecutor::kPriorityBands; ++band) {
+        const TaskMetricsSnapshot& m = snapshot.by_band[band];
+        if (m.execution.count() == 0) {
+            continue;
+        }
+        std::cout << "  " << band_names[band] << std::endl;
+        if (m.lateness.count() > 0) {
+            print_metrics_row("lateness  ", m.lateness);
+        }
+        print_metrics_row("queue wait", m.queue_wait);
+        print_metrics_row("execution ", m.execution);
+    }
+    bool counts_ok = snapshot.total.execution.count() == static_cast<uint64_t>(kDelayed + kLong + kShort) &&
+                     snapshot.total.lateness.count() == static_cast<uint64_t>(kDelayed) &&
+                     snapshot.by_band[1].lateness.count() == static_cast<uint64_t>(kDelayed);
+    // 低優先權的短任務要等所有長任務 (20 x 2 ms) 做完
+    bool starved_visible = snapshot.by_band[0].queue_wait.percentile(50) >= 40 * 1000000ULL &&
+                           snapshot.by_band[3].execution.percentile(50) >= 2 * 1000000ULL;
+    std::cout << "Per-band counts" << (counts_ok ? " (passed)" : " (failed)")
+              << ", low-priority queue wait behind 40 ms of long tasks" << (starved_visible ? " (passed)" : " (failed)")
+              << std::endl;
+}
+
+// 單一伺服器的離散事件模擬 (虛擬時間，單位 us)，ready queue 用跟 TaskScheduler 一樣的 rank
+struct SimJob {
+    int64_t arrival;
+    int64_t service;
+    int priority;
+    int64_t deadline; // < 0: 沒有截止時間
+    int64_t rank;
+};
+
+struct SimJobCompare {
+    bool operator()(const SimJob& a, const SimJob& b) const { return a.rank > b.rank; }
 };
 
+// 回傳低優先權 (priority 5) 任務的完成時間 (完成 - 到達)；沒做完的以模擬結束時間計
+std::vector<int64_t> simulate_low_priority_completion(int64_t quantum_us, bool low_has_deadline, uint64_t& misses) {
+    const int64_t kHorizon = 20 * 1000 * 1000; // 20 s
+    std::mt19937_64 rng(2024);
+    std::exponential_distribution<double> high_gap(1.0 / 1000);  // 平均每 1 ms 一個 priority 20
+    std::exponential_distribution<double> low_gap(1.0 / 20000);  // 平均每 20 ms 一個 priority 5
+    std::exponential_distribution<double> high_service(1.0 / 960);
+    const int64_t kLowService = 500;
+    const int64_t kLowDeadline = 50 * 1000;
+
+    std::vector<SimJob> arrivals;
+    for (double t = high_gap(rng); t < kHorizon; t += high_gap(rng)) {
+        arrivals.push_back({static_cast<int64_t>(t), 1 + static_cast<int64_t>(high_service(rng)), 20, -1, 0});
+    }
+    for (double t = low_gap(rng); t < kHorizon; t += low_gap(rng)) {
+        int64_t arrival = static_cast<int64_t>(t);
+        arrivals.push_back({arrival, kLowService, 5, low_has_deadline ? arrival + kLowDeadline : -1, 0});
+    }
+    std::sort(arrivals.begin(), arrivals.end(), [](const SimJob& a, const SimJob& b) { return a.arrival < b.arrival; });
+
+    std::priority_queue<SimJob, std::vector<SimJob>, SimJobCompare> ready;
+    std::vector<int64_t> completion;
+    misses = 0;
+    int64_t now = 0;
+    size_t next = 0;
+    while (now < kHorizon && (next < arrivals.size() || !ready.empty())) {
+        while (next < arrivals.size() && arrivals[next].arrival <= now) {
+            SimJob job = arrivals[next++];
+            job.rank = job.deadline >= 0 ? job.deadline
+                                         : TaskScheduler::aged_rank(job.arrival, job.priority, quantum_us);
+            ready.push(job);
+        }
+        if (ready.empty()) {
+            now = arrivals[next].arrival;
+            continue;
+        }
+        SimJob job = ready.top();
+        ready.pop();
+        now += job.service;
+        if (job.priority == 5) {
+            completion.push_back(now - job.arrival);
+            misses += (job.deadline >= 0 && now > job.deadline) ? 1 : 0;
+        }
+    }
+    while (!ready.empty()) {
+        if (ready.top().priority == 5) {
+            completion.push_back(kHorizon - ready.top().arrival);
+            ++misses;
+        }
+        ready.pop();
+    }
+    std::sort(completion.begin(), completion.end());
+    return completion;
+}
+
+void test_deadline_and_aging() {
+    std::cout << "\n--- EDF Class and Aging ---" << std::endl;
+
+    // 真的排程器: 一串會自我延續的 priority 20 任務 (每個 0.2 ms，共 300 ms) 佔住 ready queue，
+    // 一開始就提交 20 個 priority 5 的任務；中途再插一個 10 ms 截止時間的任務
+    for (int aging = 0; aging <= 1; ++aging) {
+        TaskScheduler sched;
+        sched.set_trace(false);
+        sched.set_aging_quantum(aging ? std::chrono::milliseconds(2) : std::chrono::hours(24));
+        TimePoint start = std::chrono::steady_clock::now();
+        TimePoint stream_end = start + std::chrono::milliseconds(300);
+        std::vector<double> low_done_ms;
+        bool deadline_submitted = false;
+
+        std::function<void()> stream = [&] {
+            TimePoint until = std::chrono::steady_clock::now() + std::chrono::microseconds(200);
+            while (std::chrono::steady_clock::now() < until) {
+            }
+            if (!deadline_submitted && std::chrono::steady_clock::now() > start + std::chrono::milliseconds(100)) {
+                deadline_submitted = true;
+                sched.add_deadline_task(std::chrono::milliseconds(10), [] {});
+            }
+            if (std::chrono::steady_clock::now() < stream_end) {
+                sched.add_task(20, [&stream] { stream(); });
+            }
+        };
+        sched.add_task(20, [&stream] { stream(); });
+        for (int i = 0; i < 20; ++i) {
+            sched.add_task(5, [&] {
+                low_done_ms.push_back(
+                    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            });
+        }
+        sched.run();
+
+        SchedulerMetricsSnapshot snapshot = sched.metrics_snapshot();
+        double last_low = low_done_ms.empty() ? -1 : low_done_ms.back();
+        bool ok = aging ? (low_done_ms.size() == 20 && last_low < 150) : (last_low >= 300);
+        std::cout << (aging ? "Aging (2 ms quantum)" : "Strict priority     ") << ": 20 low-priority tasks done by "
+                  << last_low << " ms (stream runs until 300 ms)" << (ok ? " (passed)" : " (failed)")
+                  << "; deadline task met " << snapshot.deadline_met << ", missed " << snapshot.deadline_missed
+                  << (snapshot.deadline_met == 1 ? " (passed)" : " (failed)") << std::endl;
+    }
+
+    // deadline miss 的記錄: 1 ms 截止時間的任務排在 5 ms 的任務後面
+    {
+        TaskScheduler sched;
+        sched.set_trace(false);
+        sched.add_deadline_task(std::chrono::milliseconds(1), [] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        });
+        sched.add_deadline_task(std::chrono::milliseconds(2), [] {});
+        sched.run();
+        SchedulerMetricsSnapshot snapshot = sched.metrics_snapshot();
+        std::cout << "Deadline misses recorded: met " << snapshot.deadline_met << ", missed " << snapshot.deadline_missed
+                  << " (overshoot p50 " << snapshot.deadline_overshoot.percentile(50) / 1000000.0 << " ms)"
+                  << ((snapshot.deadline_met == 0 && snapshot.deadline_missed == 2) ? " (passed)" : " (failed)")
+                  << std::endl;
+    }
+
+    std::cout << "Simulation: 20 s, priority 20 at ~96% load + priority 5 at ~2.5% load, p99 completion of priority 5"
+              << std::endl;
+    struct Policy {
+        const char* name;
+        int64_t quantum_us;
+        bool deadline;
+    } policies[] = {
+        {"strict priority        ", int64_t(1) << 40, false},
+        {"aging, 10 ms quantum   ", 10000, false},
+        {"aging, 2 ms quantum    ", 2000, false},
+        {"EDF, 50 ms deadline    ", 2000, true},
+    };
+    for (const Policy& policy : policies) {
+        uint64_t misses = 0;
+        std::vector<int64_t> completion = simulate_low_priority_completion(policy.quantum_us, policy.deadline, misses);
+        int64_t p50 = completion[completion.size() / 2];
+        int64_t p99 = completion[std::min(completion.size() - 1, completion.size() * 99 / 100)];
+        std::cout << "  " << policy.name << ": p50 " << p50 / 1000.0 << " ms, p99 " << p99 / 1000.0 << " ms";
+        if (policy.deadline) {
+            std::cout << ", " << misses << "/" << completion.size() << " missed the deadline";
+        }
+        std::cout << std::endl;
+    }
+}
+
+// source → 8 個平行分支 (各自加總一段資料) → merge → sink，重複執行 100 次
+void test_task_graph() {
+    std::cout << "\n--- Task Graph (DAG) ---" << std::endl;
+    const int kBranches = 8;
+    const int kRuns = 100;
+    std::vector<int64_t> data(80000);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<int64_t>(i % 1000);
+    }
+    int64_t expected = 0;
+    for (int64_t v : data) {
+        expected += v;
+    }
+
+    for (size_t workers = 0; workers <= 4; workers += 4) {
+        TaskScheduler sched(std::chrono::milliseconds(1), workers);
+        sched.set_trace(false);
+
+        std::atomic<int> sequence{0};
+        std::vector<int> order(kBranches + 3); // 每個節點這一輪的執行順序
+        std::vector<int64_t> partial(kBranches);
+        int64_t total = 0;
+        bool ok = true;
+
+        TaskGraph graph;
+        TaskGraph::NodeId source = graph.add_node(10, [&] {
+            order[0] = sequence.fetch_add(1);
+        });
+        TaskGraph::NodeId merge = graph.add_node(10, [&] {
+            order[kBranches + 1] = sequence.fetch_add(1);
+            total = 0;
+            for (int64_t p : partial) {
+                total += p;
+            }
+        });
+        TaskGraph::NodeId sink = graph.add_node(10, [&] {
+            order[kBranches + 2] = sequence.fetch_add(1);
+            ok = ok && total == expected;
+        });
+        for (int b = 0; b < kBranches; ++b) {
+            TaskGraph::NodeId branch = graph.add_node(10, [&, b] {
+                order[b + 1] = sequence.fetch_add(1);
+                size_t chunk = data.size() / kBranches;
+                int64_t sum = 0;
+                for (size_t i = b * chunk; i < (b + 1) * chunk; ++i) {
+                    sum += data[i];
+                }
+                partial[b] = sum;
+            });
+            graph.add_edge(source, branch);
+            graph.add_edge(branch, merge);
+        }
+        graph.add_edge(merge, sink);
+
+        // 排程器在另一個執行緒上常駐，這裡提交之後用 wait() 等整張圖做完
+        std::thread runner([&sched] { sched.run_forever(); });
+        long allocations_after_first = 0;
+        for (int run = 0; run < kRuns; ++run) {
+            long before = g_allocations.load();
+            sequence.store(0);
+            sched.submit(graph);
+            graph.wait();
+            if (run > 0) {
+                allocations_after_first += g_allocations.load() - before;
+            }
+            bool ordered = order[0] == 0 && order[kBranches + 2] == kBranches + 2 &&
+                           order[kBranches + 1] == kBranches + 1 && !graph.running();
+            ok = ok && ordered;
+        }
+        sched.stop();
+        runner.join();
+        std::cout << (workers == 0 ? "Single-threaded" : "Executor (4 workers)") << ": " << kRuns
+                  << " runs of a 1 -> " << kBranches << " -> 1 -> 1 graph, dependencies and sum"
+                  << (ok ? " (passed)" : " (failed)") << ", allocations after the first run "
+                  << allocations_after_first << (allocations_after_first == 0 ? " (passed)" : " (failed)") << std::endl;
+    }
+
+    TaskScheduler sched;
+    TaskGraph cyclic;
+    TaskGraph::NodeId a = cyclic.add_node(1, [] {});
+    TaskGraph::NodeId b = cyclic.add_node(1, [] {});
+    cyclic.add_edge(a, b);
+    cyclic.add_edge(b, a);
+    bool rejected = false;
+    try {
+        sched.submit(cyclic);
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    std::cout << "Cycle rejected" << (rejected && !cyclic.running() ? " (passed)" : " (failed)") << std::endl;
+}
+
+#if TASK_SCHEDULER_HAS_COROUTINES
+// 「送出 → 等 → 輪詢 → 讓出 → 等」的多步驟流程
+CoTask request_flow(TaskScheduler& sched, int id, std::atomic<int>& steps) {
+    steps.fetch_add(1, std::memory_order_relaxed); // send
+    co_await sched.sleep_for(std::chrono::milliseconds(1 + id % 5));
+    steps.fetch_add(1, std::memory_order_relaxed); // poll
+    co_await sched.yield();
+    co_await sched.sleep_for(std::chrono::milliseconds(1));
+    steps.fetch_add(1, std::memory_order_relaxed); // done
+}
+
+long coroutine_round_allocations(TaskScheduler& sched, std::atomic<int>& steps) {
+    long before = g_allocations.load();
+    for (int i = 0; i < 1000; ++i) {
+        sched.spawn(i % 30, request_flow(sched, i, steps));
+    }
+    sched.run();
+    return g_allocations.load() - before;
+}
+
+CoTask narrated_flow(TaskScheduler& sched, const char* name, TimePoint start) {
+    auto elapsed = [start] {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    };
+    std::cout << "  [" << name << " @" << elapsed() << " ms] send request" << std::endl;
+    co_await sched.sleep_for(std::chrono::milliseconds(50));
+    std::cout << "  [" << name << " @" << elapsed() << " ms] poll status" << std::endl;
+    co_await sched.yield();
+    co_await sched.sleep_for(std::chrono::milliseconds(30));
+    std::cout << "  [" << name << " @" << elapsed() << " ms] done" << std::endl;
+}
+
+void test_coroutines() {
+    std::cout << "\n--- C++20 Coroutine Front-end ---" << std::endl;
+    {
+        TaskScheduler sched;
+        sched.set_trace(false);
+        sched.spawn(10, narrated_flow(sched, "flow", std::chrono::steady_clock::now()));
+        sched.run();
+    }
+    for (size_t workers = 0; workers <= 2; workers += 2) {
+        TaskScheduler sched(std::chrono::milliseconds(1), workers);
+        sched.set_trace(false);
+        std::atomic<int> steps{0};
+        long warmup = coroutine_round_allocations(sched, steps);
+        size_t frames = CoroutineFramePool::instance().blocks();
+        long steady = coroutine_round_allocations(sched, steps);
+        std::cout << (workers == 0 ? "Single-threaded" : "Executor (2 workers)") << ": 2 x 1000 flows, steps "
+                  << steps.load() << (steps.load() == 6000 ? " (passed)" : " (failed)") << "; warm-up " << warmup
+                  << " allocations, steady round " << steady << (steady == 0 ? " (passed)" : " (failed)")
+                  << "; pooled frames " << frames << " -> " << CoroutineFramePool::instance().blocks() << std::endl;
+    }
+}
+#endif
+
+// 1M 個等待中的 timer: 時間輪 vs priority_queue
+void benchmark_timers() {
+    const int n = 1000000;
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> delay_ms(1, 60000);
+    std::vector<uint64_t> delays(n);
+    for (auto& d : delays) {
+        d = delay_ms(rng);
+    }
+    auto ns_per_op = [n](std::chrono::steady_clock::duration d) {
+        return std::chrono::duration<double, std::nano>(d).count() / n;
+    };
+
+    // heap: 插入 1M 個，再依到期順序全部取出 (heap 無法取消，只能到期後丟掉)
+    {
+        TimePoint base = std::chrono::steady_clock::now();
+        std::priority_queue<Task, std::vector<Task>, DelayedTaskCompare> heap;
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; ++i) {
+            heap.push({0, [] {}, base + std::chrono::milliseconds(delays[i])});
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        while (!heap.empty()) {
+            heap.pop();
+        }
+        auto t2 = std::chrono::steady_clock::now();
+        std::cout << "Heap:  insert " << ns_per_op(t1 - t0) << " ns/op, pop " << ns_per_op(t2 - t1)
+                  << " ns/op, cancel unsupported" << std::endl;
+    }
+
+    // 時間輪: 插入 1M 個，取消 90%，再把時間推進到最後讓剩下的到期
+    {
+        std::vector<TaskNode*> nodes(n);
+        for (int i = 0; i < n; ++i) {
+            nodes[i] = new TaskNode;
+            nodes[i]->task = {0, [] {}, {}};
+            nodes[i]->expire_tick = delays[i];
+        }
+        TimingWheel wheel;
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; ++i) {
+            wheel.insert(nodes[i]);
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; ++i) {
+            if (i % 10 != 0) {
+                wheel.remove(nodes[i]);
+            }
+        }
+        auto t2 = std::chrono::steady_clock::now();
+        size_t expired = 0;
+        uint64_t last_tick = 0;
+        bool in_order = true;
+        wheel.advance_to(60001, [&](TaskNode* node) {
+            in_order = in_order && node->expire_tick >= last_tick && node->expire_tick == wheel.current_tick();
+            last_tick = node->expire_tick;
+            ++expired;
+        });
+        auto t3 = std::chrono::steady_clock::now();
+        std::cout << "Wheel: insert " << ns_per_op(t1 - t0) << " ns/op, cancel " << ns_per_op(t2 - t1) * n / (n - n / 10)
+                  << " ns/op, expire remaining " << ns_per_op(t3 - t2) * n / expired << " ns/op" << std::endl;
+        std::cout << "Wheel expired " << expired << " timers on their exact tick: "
+                  << ((expired == static_cast<size_t>(n / 10) && in_order) ? "passed" : "failed") << std::endl;
+        for (auto* node : nodes) {
+            delete node;
+        }
+    }
+}
+
+// CPU-bound 任務在不同 worker 數下的加速比
+void benchmark_executor_scaling() {
+    const int num_tasks = 256;
+    const int iterations = 2000000;
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    double baseline = 0;
+
+    // 1, 2, 4, ... 小於核心數的 2 的冪次，最後一輪剛好用滿所有核心
+    std::vector<unsigned> worker_counts;
+    for (unsigned w = 1; w < cores; w *= 2) {
+        worker_counts.push_back(w);
+    }
+    worker_counts.push_back(cores);
+
+    for (unsigned workers : worker_counts) {
+        std::atomic<uint64_t> checksum{0};
+        TaskScheduler scheduler(std::chrono::milliseconds(1), workers);
+        for (int i = 0; i < num_tasks; ++i) {
+            scheduler.add_task(i % 30, [&checksum, i, iterations] {
+                uint64_t x = static_cast<uint64_t>(i) + 1;
+                for (int k = 0; k < iterations; ++k) {
+                    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+                }
+                checksum.fetch_add(x, std::memory_order_relaxed);
+            });
+        }
+        auto start = std::chrono::steady_clock::now();
+        scheduler.run();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (workers == 1) {
+            baseline = seconds;
+        }
+        std::cout << workers << " worker(s): " << seconds * 1000 << " ms, speedup " << baseline / seconds
+                  << "x (checksum " << (checksum.load() != 0 ? "ok" : "missing") << ")" << std::endl;
+    }
+}
+
 // --- main 函式用於測試 ---
 int main() {
     TaskScheduler scheduler;
@@ -92,6 +2274,234 @@ int main() {
     // 3. 執行調度器
     scheduler.run();
 
+    std::cout << "\n--- Steady-State Allocations ---" << std::endl;
+    {
+        std::atomic<int> counter{0};
+        TaskScheduler single;
+        single.set_trace(false);
+        long warmup = scheduling_round_allocations(single, counter, 1000);
+        long steady = scheduling_round_allocations(single, counter, 500);
+        std::cout << "Single-threaded: warm-up round " << warmup << " allocations, steady round " << steady
+                  << (steady == 0 ? " (passed)" : " (failed)") << std::endl;
+
+        TaskScheduler parallel(std::chrono::milliseconds(1), 2);
+        parallel.set_trace(false);
+        warmup = scheduling_round_allocations(parallel, counter, 1000);
+        steady = scheduling_round_allocations(parallel, counter, 500);
+        std::cout << "Executor (2 workers): warm-up round " << warmup << " allocations, steady round " << steady
+                  << (steady == 0 ? " (passed)" : " (failed)") << std::endl;
+        std::cout << "Tasks executed: " << counter.load() << (counter.load() == 2 * (3000 + 1500) ? " (passed)" : " (failed)")
+                  << std::endl;
+    }
+
+    std::cout << "\n--- Cancellation Handles and Periodic Tasks ---" << std::endl;
+    for (size_t workers = 0; workers <= 2; workers += 2) {
+        TaskScheduler sched(std::chrono::milliseconds(1), workers);
+        sched.set_trace(false);
+        std::atomic<int> timeouts_fired{0};
+        std::atomic<long> rescheduled_at_ms{-1};
+        auto start = std::chrono::steady_clock::now();
+
+        // 1000 個 200 ms 的逾時，999 個在到期前取消
+        std::vector<TaskHandle> timeouts;
+        for (int i = 0; i < 1000; ++i) {
+            timeouts.push_back(sched.run_task_after(std::chrono::milliseconds(200), 5,
+                                                    [&timeouts_fired] { timeouts_fired.fetch_add(1); }));
+        }
+        int cancelled = 0;
+        for (int i = 1; i < 1000; ++i) {
+            cancelled += timeouts[i].cancel() ? 1 : 0;
+        }
+        bool double_cancel = timeouts[1].cancel();
+
+        // 1 秒後的任務提前到 20 ms
+        TaskHandle late = sched.run_task_after(std::chrono::milliseconds(1000), 5, [&rescheduled_at_ms, start] {
+            rescheduled_at_ms = static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count());
+        });
+        late.reschedule(std::chrono::milliseconds(20));
+
+        // 每 10 ms 一次、每次做 3 ms 的事；第 20 次由自己取消
+        const int kRuns = 20;
+        std::vector<TimePoint> ticks;
+        ticks.reserve(kRuns);
+        TaskHandle periodic;
+        std::mutex periodic_mtx;
+        TimePoint grid_origin;
+        {
+            std::lock_guard<std::mutex> lock(periodic_mtx);
+            grid_origin = std::chrono::steady_clock::now(); // run_every 的排程格點從呼叫當下起算
+            periodic = sched.run_every(std::chrono::milliseconds(10), 5, [&] {
+                ticks.push_back(std::chrono::steady_clock::now());
+                std::this_thread::sleep_for(std::chrono::milliseconds(3));
+                if (ticks.size() == kRuns) {
+                    std::lock_guard<std::mutex> lock(periodic_mtx);
+                    periodic.cancel();
+                }
+            });
+        }
+        sched.run();
+        bool stale_cancel = timeouts[0].cancel() || late.cancel() || periodic.cancel() ||
+                            late.reschedule(std::chrono::milliseconds(20));
+
+        // 沒有漂移: 第 k 次要落在排程格點 grid_origin + m * period 之後，m 嚴格遞增，晚到的量不隨 k 累積。
+        // 以呼叫 run_every 的時間為基準，而不是第一次實際執行的時間，第一次晚到才不會把後面每一次都算成提早。
+        // 單核的機器上 sleep 偶爾會被搶走 ~10 ms，所以看晚到量的中位數而不是最大值: 正確的 fixed rate
+        // 大約是 1 個 tick，天真的「執行完再等 period」每次多晚 3 ms，對格點取餘數後中位數約 5 ms，還會跳過好幾格
+        double span_ms = std::chrono::duration<double, std::milli>(ticks.back() - ticks.front()).count();
+        std::vector<double> lateness_ms;
+        long last_slot = 0;
+        long skipped = 0;
+        bool slots_increase = true;
+        for (size_t k = 0; k < ticks.size(); ++k) {
+            double offset_ms = std::chrono::duration<double, std::milli>(ticks[k] - grid_origin).count();
+            long slot = static_cast<long>(std::floor(offset_ms / 10.0));
+            lateness_ms.push_back(offset_ms - 10.0 * static_cast<double>(slot));
+            slots_increase = slots_increase && slot > last_slot;
+            skipped += slot - last_slot - 1;
+            last_slot = slot;
+        }
+        std::sort(lateness_ms.begin(), lateness_ms.end());
+        double median_lateness_ms = lateness_ms.empty() ? 0 : lateness_ms[lateness_ms.size() / 2];
+        double max_lateness_ms = lateness_ms.empty() ? 0 : lateness_ms.back();
+        bool on_grid = ticks.size() == kRuns && slots_increase && median_lateness_ms < 3;
+
+        std::cout << (workers == 0 ? "Single-threaded" : "Executor (2 workers)") << ": cancelled " << cancelled
+                  << "/999, fired " << timeouts_fired.load()
+                  << ((cancelled == 999 && timeouts_fired.load() == 1 && !double_cancel) ? " (passed)" : " (failed)")
+                  << "; rescheduled 1000 ms -> 20 ms ran at " << rescheduled_at_ms.load() << " ms"
+                  << ((rescheduled_at_ms.load() >= 20 && rescheduled_at_ms.load() < 200) ? " (passed)" : " (failed)")
+                  << std::endl;
+        std::cout << "  periodic: " << ticks.size() << " runs, run 1 -> run " << kRuns << " = " << span_ms
+                  << " ms (ideal " << 19 * 10 << ", naive re-arm ~" << 19 * 13 << "), lateness vs schedule median "
+                  << median_lateness_ms << " / max " << max_lateness_ms << " ms, skipped periods " << skipped << (on_grid ? " (passed)" : " (failed)")
+                  << "; stale handles rejected" << (!stale_cancel ? " (passed)" : " (failed)") << std::endl;
+    }
+    {
+        // 計時器已經到期、還在 ready queue 排隊的任務不能再改期: 前面的任務佔住 run() 30 ms，
+        // 5 ms 與 10 ms 的計時器在同一輪到期，priority 高的那個先跑，這時 5 ms 的任務已是 Due
+        TaskScheduler sched(std::chrono::milliseconds(1), 0);
+        sched.set_trace(false);
+        std::atomic<int> target_runs{0};
+        bool moved_after_due = true;
+        sched.run_task_after(std::chrono::milliseconds(0), 5,
+                             [] { std::this_thread::sleep_for(std::chrono::milliseconds(30)); });
+        TaskHandle target = sched.run_task_after(std::chrono::milliseconds(5), 5, [&target_runs] { target_runs.fetch_add(1); });
+        sched.run_task_after(std::chrono::milliseconds(10), 30, [&] {
+            moved_after_due = target.reschedule(std::chrono::milliseconds(100));
+        });
+        sched.run();
+        std::cout << "Reschedule after the timer fired: returned " << (moved_after_due ? "true" : "false")
+                  << ", task ran " << target_runs.load() << " time(s)"
+                  << ((!moved_after_due && target_runs.load() == 1) ? " (passed)" : " (failed)") << std::endl;
+    }
+
+#if TASK_SCHEDULER_HAS_COROUTINES
+    test_coroutines();
+#endif
+
+    test_metrics();
+    test_deadline_and_aging();
+    test_task_graph();
+
+    std::cout << "\n--- Long-lived Scheduler Fed by Other Threads ---" << std::endl;
+    {
+        TaskScheduler service;
+        service.set_trace(false);
+        std::atomic<int> executed{0};
+        std::thread loop([&service] { service.run_forever(); });
+
+        // 閒置期間: 只有一個 300 ms 後到期的任務，run 執行緒應該睡著而不是 poll
+        service.run_task_after(std::chrono::milliseconds(300), 1, [&executed] { executed.fetch_add(1); });
+        std::clock_t cpu_before = std::clock();
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        double idle_cpu_ms = 1000.0 * (std::clock() - cpu_before) / CLOCKS_PER_SEC;
+        std::cout << "CPU time while idle for 200 ms: " << idle_cpu_ms << " ms"
+                  << (idle_cpu_ms < 20 ? " (no busy-poll, passed)" : " (failed)") << std::endl;
+
+        std::vector<std::thread> producers;
+        for (int p = 0; p < 4; ++p) {
+            producers.emplace_back([&service, &executed] {
+                for (int i = 0; i < 10000; ++i) {
+                    if (i % 4 == 0) {
+                        service.run_task_after(std::chrono::milliseconds(i % 50), i % 30,
+                                               [&executed] { executed.fetch_add(1); });
+                    } else {
+                        service.add_task(i % 30, [&executed] { executed.fetch_add(1); });
+                    }
+                }
+            });
+        }
+        for (auto& t : producers) {
+            t.join();
+        }
+        while (executed.load() < 40001) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        service.stop();
+        loop.join();
+        std::cout << "Tasks from 4 producer threads executed: " << executed.load()
+                  << (executed.load() == 40001 ? " (passed)" : " (failed)") << std::endl;
+    }
+    {
+        // 在 run_forever 開始前呼叫的 stop() 不能被吃掉；返回後旗標清掉，可以再跑一次
+        TaskScheduler service;
+        service.set_trace(false);
+        std::atomic<int> returned{0};
+        auto serve = [&service, &returned] {
+            service.run_forever();
+            returned.fetch_add(1);
+        };
+        auto wait_returned = [&returned](int count) {
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+            while (returned.load() < count && std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            return returned.load() >= count;
+        };
+        service.stop();
+        std::thread first(serve);
+        bool stop_before_run = wait_returned(1);
+        if (!stop_before_run) {
+            service.stop();
+        }
+        first.join();
+
+        std::thread second(serve);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        bool kept_running = returned.load() == 1;
+        service.stop();
+        bool stopped_again = wait_returned(2);
+        second.join();
+        std::cout << "stop() before run_forever: returned immediately " << (stop_before_run ? "yes" : "no")
+                  << ", next run_forever serves until stop() " << (kept_running && stopped_again ? "yes" : "no")
+                  << ((stop_before_run && kept_running && stopped_again) ? " (passed)" : " (failed)") << std::endl;
+    }
+
+    std::cout << "\n--- Work-Stealing Executor (4 workers) ---" << std::endl;
+    {
+        TaskScheduler parallel(std::chrono::milliseconds(1), 4);
+        parallel.set_trace(false);
+        std::atomic<int> done{0};
+        for (int i = 0; i < 1000; ++i) {
+            parallel.add_task(i % 40, [&parallel, &done] {
+                // worker 上產生的子任務與延遲任務
+                parallel.add_task(5, [&done] { done.fetch_add(1, std::memory_order_relaxed); });
+                parallel.run_task_after(std::chrono::milliseconds(20), 5,
+                                        [&done] { done.fetch_add(1, std::memory_order_relaxed); });
+            });
+        }
+        parallel.run();
+        std::cout << "Tasks completed: " << done.load() << (done.load() == 2000 ? " (passed)" : " (failed)")
+                  << std::endl;
+    }
+
+    std::cout << "\n--- Benchmark: executor scaling (CPU-bound) ---" << std::endl;
+    benchmark_executor_scaling();
+
+    std::cout << "\n--- Benchmark: 1M pending timers ---" << std::endl;
+    benchmark_timers();
+
     std::cout << "--- Test Ended ---" << std::endl;
     return 0;
 }
@@ -99,4 +2509,5 @@ int main() {
 /*
 如何編譯與執行:
 g++ your_file_name.cpp -std=c++11 -o program -pthread
-*/
\ No newline at end of file
+g++ your_file_name.cpp -std=c++20 -o program -pthread   (含協程介面)
+*/
@@ -4,7 +4,30 @@
 #include <iostream>
 #include <vector>
 #include <string>
-#include <functional> // for std::hash
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <stdexcept>
+#include <utility>
+#include <functional>
+#include <memory>
+#include <system_error>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define MERKLE_HAS_SIMD_KERNELS 1
+#else
+#define MERKLE_HAS_SIMD_KERNELS 0
+#endif
 
 /*
 [題目描述]
@@ -16,76 +39,1688 @@
     - 從葉節點層開始，兩兩一組，將相鄰兩個節點的雜湊值串接起來，再對這個新字串計算雜湊，從而生成它們的父節點。
     - 重複這個過程，不斷產生上一層的節點，直到只剩下一個節點為止。這個最後的節點就是默克爾根 (Merkle Root)。
 3.  **處理奇數節點**: 如果在某一層的節點數量是奇數，通常的作法是將最後一個節點複製一份，與其自身進行雜湊來產生父節點。
-4.  **雜湊函式**: 在這個範例中，我們使用 `std::hash` 來模擬一個雜湊函式。在實際的儲存系統中，會使用如 SHA-256 等加密安全雜湊函式。
+4.  **雜湊函式**: 使用 SHA-256 (FIPS 180-4)，摘要為固定 32 位元組的 `Digest`，而非字串。
 5.  **實現**:
     - 類別接收一個 `std::vector<std::string>` 作為資料塊。
     - `build_tree` 函式負責實現上述的逐層建構邏輯。
-    - `getRootHash` 方法回傳最終計算出的根雜湊。
+    - `getRootHash` 方法回傳最終計算出的根雜湊 (十六進位字串)，`root()` 回傳原始 32 位元組摘要。
+
+[延伸: 二進位摘要、SHA-256 與網域分隔]
+- 舊版以 `std::hash` 的十進位字串當作雜湊值，父節點再雜湊兩個字串的串接：每一層都在配置字串，
+  而且 `std::hash` 不具抗碰撞性，無法用於完整性驗證。
+- 現在每個節點是 `std::array<uint8_t, 32>`，每一層存放在一個連續的 `std::vector<Digest>` 中 (`levels[0]` 為葉節點，
+  `levels.back()` 只有根)，整棵樹的節點總數約 2n，沒有任何逐節點的配置。
+- **網域分隔** (同 RFC 6962)：葉節點 = SHA-256(0x00 || data)，內部節點 = SHA-256(0x01 || left || right)。
+  若不分隔，攻擊者可以把某個內部節點的 64 位元組 (left || right) 當成一個「資料塊」，偽造出同根但不同葉數的樹。
+- **父節點快速路徑**：0x01 || left || right 共 65 位元組，固定佔兩個 SHA-256 區塊。`hash_node` 直接在堆疊上
+  組出這兩個已填充 (padding) 的區塊並呼叫壓縮函式兩次，不經過通用的串流介面，也不做任何配置。
+
+[延伸: 多緩衝 SIMD 葉雜湊與執行期分派]
+- 對數百萬個資料塊建樹時，成本幾乎全在葉雜湊。SHA-256 單一訊息內的 64 輪彼此相依，很難向量化；
+  但不同葉節點之間完全獨立，所以改成「多緩衝」：每個 SIMD lane 負責一則訊息，同一條指令同時推進
+  4 / 8 / 16 則訊息的同一輪 (SSE2 / AVX2 / AVX-512)。
+- 核心 `leaf_simd::hash_lanes<Lanes>` 用 GCC/Clang 的向量擴充寫一次，再由帶 `__attribute__((target(...)))`
+  的包裝函式實例化成各指令集版本；`best_leaf_hash_kernel()` 第一次呼叫時以 `__builtin_cpu_supports`
+  挑出 CPU 支援的最寬核心，之後不再判斷。非 x86-64 平台只有純量核心。
+- 各 lane 的訊息長度可以不同：完全落在 data 內的區塊直接從原資料讀取 (不複製)，只有含 0x00 前綴或尾端
+  填充的區塊組在堆疊上的 scratch 中；已經結束的 lane 用遮罩保持狀態不變。不滿一組的尾端用最後一個葉節點補齊。
+- `build_tree` 每次收集 64 個葉節點的指標交給 `hash_leaves`，不做額外配置。
+  `main` 會列出每個核心相對純量版本的 GB/s，並確認所有核心對不同長度的葉節點結果都與 `hash_leaf` 相同。
+
+[延伸: 多核心平行建構]
+- 單執行緒逐層歸約時，每一層都要等上一層全部完成；若每層都切給多個執行緒，就需要每層一次 barrier。
+- 改成切子樹：選一個高度 k，把葉節點切成 2^k 一塊 (最後一塊可以不滿)。因為每塊的起點是 2^k 的倍數，
+  塊內 k 層的配對方式與整棵樹完全相同，奇數節點也只會出現在整層最右端、也就是最後一塊裡，
+  所以各塊獨立算完葉雜湊並歸約 k 層後，得到的正是整棵樹第 k 層的節點，根與單執行緒版本逐位元相同。
+- 所有層在建構前依 ceil(n / 2^j) 一次配置好，各執行緒只寫自己負責的區段，不需要鎖。
+  執行緒以原子計數器領取子樹 (塊數約為執行緒數的 4 倍，較慢的執行緒不會拖住整體)，全部 join 之後
+  只剩約 4 × threads 個子樹根，由單執行緒合併到根。整個建構只有結尾一次同步。
+- 葉雜湊改用多緩衝核心後，內部節點 (約 n 個、每個兩次壓縮) 反而成為純量瓶頸。同一層相鄰的兩個摘要在連續陣列中
+  正好是 left || right，所以 `hash_node_pairs` 直接把 &level[2i] 當成 64 位元組訊息、以 0x01 為網域前綴交給
+  同一個核心，每個子樹內的歸約也是多緩衝的。
+- `MerkleTree(blocks, threads)`：threads = 1 為原本的單執行緒版本，0 表示 `hardware_concurrency()`。
+
+[延伸: 保留內部節點與 O(log n) 增量更新]
+- 建構後保留每一層 (`levels`)，任何修改都只需重算受影響的路徑，不必重建整棵樹：
+  - `update(index, block)`：重算葉節點及其到根的 ceil(log2 n) 個祖先。
+  - `update({{index, block}, ...})`：先換掉所有葉節點，再由下往上逐層處理「髒」節點集合 (排序後把同一個父節點
+    去重)，共同祖先只重算一次；回傳實際重算的內部節點數。
+  - `append(block)`：新葉節點到根的路徑是唯一受影響的節點 (原本奇數配對自身的最右節點，其父節點也在這條路徑上)，
+    各層以 `push_back`/`resize` 延伸，樹長高時在頂端多加一層；每次追加 O(log n)，適合持續成長的日誌。
+- `verify(blocks)` 不再建第二棵樹：葉雜湊相同就代表整棵樹相同，所以只逐批比對葉雜湊，遇到第一個不同就返回。
+
+[延伸: 包含證明 (inclusion proof)]
+- 過去驗證單一資料塊必須拿到全部資料重建整棵樹。`prove(index)` 回傳 `MerkleProof`：葉節點到根路徑上
+  每一層的兄弟摘要 (至多 ceil(log2 n) 個)；最右端與自身配對的節點沒有兄弟，不放進證明，驗證端由 `leaf_count` 推得。
+- `verify_proof(leaf, index, proof, root)` 是獨立函式：從 hash_leaf(leaf) 出發，依 index 每一位決定兄弟在左或右，
+  逐層做 hash_node，最後與根比較；客戶端只需要單一資料塊、證明與可信的根，O(log n) 次雜湊。
+- 序列化格式 `[版本 1B][leaf_count varint][32B × k]`：一百萬個資料塊的證明為 1 + 3 + 20 × 32 = 644 位元組。
+  `MerkleProof::parse` 遇到未知版本或截斷的摘要時丟出 `std::invalid_argument`。
+- `leaf_count` 必須與根一起由可信來源取得：採用「奇數節點與自身配對」規則時，[A, B, C] 與 [A, B, C, C] 的根相同。
+
+[延伸: 差異比對與反熵同步]
+- 過去比對副本只能呼叫 `verify`，得到「相同 / 不同」，不同就全部複製。`diff(other)` 由根往下逐層走，
+  只展開兩邊摘要不同的節點，最後把相鄰的葉節點合併成 `BlockRange` 區間，回傳確切改動的資料塊。
+  兩棵樹大小不同時，從兩者共有的最高層開始比，多出來的尾端整段列為差異。
+- 同樣的走訪抽象成「給定層與索引，向對方要摘要」，所以也能跨行程：`diff_remote(round_trip)` 是客戶端，
+  `handle_sync_request(request)` 是伺服端，中間只交換位元組字串 (格式見 `merkle_sync`，索引以遞增差值的 varint 編碼)。
+  每層一次往返 (共樹高 + 1 次)，總共交換 O(差異數 × log n) 個摘要，而不是 n 個。
+- `main` 以一個計算往返次數與位元組數的 lambda 當作傳輸層替身，並用 `update` 套用差異後確認兩個副本的根相同。
+
+[延伸: 大檔案的串流 / mmap 建構]
+- `MerkleTree` 需要把整份資料放進 `std::vector<std::string>`，記憶體加倍、每個位元組都被複製一次。
+- `MerkleStreamBuilder` 依序接收葉雜湊，像二進位計數器一樣每層只留一個等待右兄弟的節點，記憶體 O(樹高)；
+  `finish()` 由下往上收尾，最右端沒有兄弟的節點與自身配對，根與 `MerkleTree` 完全相同。
+- `hash_file(path, block_size, use_mmap)`：
+  - 一般檔案以約 64 MiB 的視窗 mmap (起點對齊頁面、`MADV_SEQUENTIAL`)，直接在映射的頁面上切塊並交給多緩衝葉雜湊，
+    用完即 `munmap`，所以任何大小的檔案常駐記憶體都只有一個視窗。
+  - pipe 等非一般檔案 (或 use_mmap = false) 改用大的 `read()` 填滿緩衝區；短讀時繼續讀到填滿，切塊邊界才固定。
+  - 除了一個視窗與 O(樹高) 個摘要之外不保留任何東西；錯誤以 `std::system_error` 回報。
+
+[延伸: 內容定義切塊 (FastCDC)]
+- 固定大小切塊時，在檔案開頭插入一個位元組，後面每一塊的內容都會位移，所有葉節點都變了，去重同步只好全部重傳。
+- `FastCdcChunker(min, avg, max)` 以 gear hash 滾動 (h = (h << 1) + gear[byte]，高位元只反映最近 64 個位元組)，
+  遇到高位全為 0 的位置就切，所以切點跟著內容走；插入或刪除只影響附近的一兩塊，之後的切點會重新對齊。
+  - 前 min 位元組不可能是切點，直接跳過不計算。
+  - 正規化切塊：avg 之前用 log2(avg) + 2 位的遮罩 (較難切)，之後用 log2(avg) - 2 位 (較易切)，塊大小集中在 avg 附近；
+    到 max 仍未切就強制切。
+- 切塊策略抽象成 `cut(data, len, eof)`：回傳下一塊長度，資料不足以決定時回傳 0。`hash_file_chunked(path, chunker)`
+  對固定大小 (`FixedSizeChunker`，即原本的 `hash_file`) 與 FastCDC 共用同一條 mmap / read() 路徑，跨越視窗尾端的塊
+  從下一個視窗重新處理；可選擇輸出每塊的 `ChunkRecord` (位置、長度、雜湊) 作為去重索引。
+- `main` 量測切塊吞吐量，並在插入 / 刪除 / 覆寫後的檔案上比較固定大小與 FastCDC 的去重比例。
 */
 
+// 32 位元組的二進位摘要
+using Digest = std::array<uint8_t, 32>;
+
+// SHA-256 (FIPS 180-4) 純 C++ 實作
+namespace sha256 {
+
+static const uint32_t kRoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t kInitialState[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+inline uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+inline uint32_t load_be32(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+inline void store_be32(uint8_t* p, uint32_t v) {
+    p[0] = uint8_t(v >> 24); p[1] = uint8_t(v >> 16); p[2] = uint8_t(v >> 8); p[3] = uint8_t(v);
+}
+
+// 壓縮函式：以一個 64 位元組區塊更新 8 個字的狀態
+inline void compress(uint32_t state[8], const uint8_t block[64]) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) w[i] = load_be32(block + 4 * i);
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + kRoundConstants[i] + w[i];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+inline Digest state_to_digest(const uint32_t state[8]) {
+    Digest out;
+    for (int i = 0; i < 8; ++i) store_be32(out.data() + 4 * i, state[i]);
+    return out;
+}
+
+// 串流介面：內部只有 64 位元組緩衝區，不做配置
+class Hasher {
+private:
+    uint32_t state[8];
+    uint8_t buffer[64];
+    size_t buffered = 0;
+    uint64_t total_bytes = 0;
+
+public:
+    Hasher() { std::memcpy(state, kInitialState, sizeof(state)); }
+
+    void update(const void* data, size_t len) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        total_bytes += len;
+        if (buffered > 0) {
+            size_t take = std::min(len, sizeof(buffer) - buffered);
+            std::memcpy(buffer + buffered, p, take);
+            buffered += take; p += take; len -= take;
+            if (buffered < sizeof(buffer)) return;
+            compress(state, buffer);
+            buffered = 0;
+        }
+        for (; len >= 64; p += 64, len -= 64) compress(state, p);
+        std::memcpy(buffer, p, len);
+        buffered = len;
+    }
+
+    Digest finish() {
+        uint64_t bit_len = total_bytes * 8;
+        buffer[buffered++] = 0x80;
+        if (buffered > 56) {
+            std::memset(buffer + buffered, 0, 64 - buffered);
+            compress(state, buffer);
+            buffered = 0;
+        }
+        std::memset(buffer + buffered, 0, 56 - buffered);
+        for (int i = 0; i < 8; ++i) buffer[56 + i] = uint8_t(bit_len >> (56 - 8 * i));
+        compress(state, buffer);
+        return state_to_digest(state);
+    }
+};
+
+inline Digest digest(const void* data, size_t len) {
+    Hasher h;
+    h.update(data, len);
+    return h.finish();
+}
+
+} // namespace sha256
+
+// 網域分隔前綴 (RFC 6962)
+static const uint8_t kLeafPrefix = 0x00;
+static const uint8_t kNodePrefix = 0x01;
+
+// 葉節點雜湊：SHA-256(0x00 || data)
+inline Digest hash_leaf(const void* data, size_t len) {
+    sha256::Hasher h;
+    h.update(&kLeafPrefix, 1);
+    h.update(data, len);
+    return h.finish();
+}
+
+// 內部節點雜湊：SHA-256(0x01 || left || right)，65 位元組固定兩個區塊，直接在堆疊上填充
+inline Digest hash_node(const Digest& left, const Digest& right) {
+    uint8_t blocks[128];
+    blocks[0] = kNodePrefix;
+    std::memcpy(blocks + 1, left.data(), 32);
+    std::memcpy(blocks + 33, right.data(), 32);
+    blocks[65] = 0x80;
+    std::memset(blocks + 66, 0, 128 - 66 - 8);
+    const uint64_t bit_len = 65 * 8;
+    for (int i = 0; i < 8; ++i) blocks[120 + i] = uint8_t(bit_len >> (56 - 8 * i));
+
+    uint32_t state[8];
+    std::memcpy(state, sha256::kInitialState, sizeof(state));
+    sha256::compress(state, blocks);
+    sha256::compress(state, blocks + 64);
+    return sha256::state_to_digest(state);
+}
+
+inline std::string to_hex(const Digest& d) {
+    static const char kHex[] = "0123456789abcdef";
+    std::string s(64, '0');
+    for (size_t i = 0; i < d.size(); ++i) {
+        s[2 * i] = kHex[d[i] >> 4];
+        s[2 * i + 1] = kHex[d[i] & 0xf];
+    }
+    return s;
+}
+
+// ---- 多緩衝 (multi-buffer) 葉雜湊 ----
+// 一次對 Lanes 個互相獨立的葉節點做 SHA-256，每個 SIMD lane 負責一則訊息。
+namespace leaf_simd {
+
+// 訊息 domain || data 的第 b 個已填充區塊：完全落在 data 內的區塊直接回傳指標 (不複製)，
+// 含前綴或尾端填充的區塊則組在 scratch 中
+inline const uint8_t* padded_block(uint8_t domain, const uint8_t* data, size_t len, size_t b,
+                                   size_t total_blocks, uint8_t scratch[64]) {
+    const size_t message_len = len + 1;
+    const size_t start = 64 * b;
+    if (b >= 1 && start + 64 <= message_len) return data + start - 1;
+    if (b >= total_blocks) return scratch; // 此 lane 已結束，內容不影響結果
+
+    std::memset(scratch, 0, 64);
+    size_t lo = start;
+    if (lo == 0) {
+        scratch[0] = domain;
+        lo = 1;
+    }
+    size_t hi = std::min(start + 64, message_len);
+    if (hi > lo) std::memcpy(scratch + (lo - start), data + lo - 1, hi - lo);
+    if (message_len >= start && message_len < start + 64) scratch[message_len - start] = 0x80;
+    if (b + 1 == total_blocks) {
+        const uint64_t bit_len = uint64_t(message_len) * 8;
+        for (int i = 0; i < 8; ++i) scratch[56 + i] = uint8_t(bit_len >> (56 - 8 * i));
+    }
+    return scratch;
+}
+
+inline size_t padded_block_count(size_t len) { return (len + 1 + 8) / 64 + 1; }
+
+#if MERKLE_HAS_SIMD_KERNELS
+// GCC/Clang 向量擴充：同一份核心依 lane 數實例化，再由帶 target 屬性的包裝函式
+// 決定實際指令集 (SSE2 = 4 lanes、AVX2 = 8 lanes、AVX-512 = 16 lanes)
+typedef uint32_t U32x4 __attribute__((vector_size(16)));
+typedef uint32_t U32x8 __attribute__((vector_size(32)));
+typedef uint32_t U32x16 __attribute__((vector_size(64)));
+
+template <int Lanes> struct LaneVector;
+template <> struct LaneVector<4> { typedef U32x4 type; };
+template <> struct LaneVector<8> { typedef U32x8 type; };
+template <> struct LaneVector<16> { typedef U32x16 type; };
+
+#define MERKLE_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+template <int Lanes>
+__attribute__((always_inline)) inline void hash_lanes(uint8_t domain, const uint8_t* const* data, const size_t* len,
+                                                      Digest* out) {
+    typedef typename LaneVector<Lanes>::type V;
+
+    size_t blocks[Lanes];
+    size_t max_blocks = 0;
+    for (int l = 0; l < Lanes; ++l) {
+        blocks[l] = padded_block_count(len[l]);
+        max_blocks = std::max(max_blocks, blocks[l]);
+    }
+
+    V state[8];
+    for (int i = 0; i < 8; ++i) state[i] = V{} + sha256::kInitialState[i];
+
+    uint8_t scratch[Lanes][64];
+    alignas(64) uint32_t words[16][Lanes];
+    for (size_t b = 0; b < max_blocks; ++b) {
+        // 轉置：words[i][l] = 第 l 則訊息第 b 個區塊的第 i 個字
+        V active = V{};
+        for (int l = 0; l < Lanes; ++l) {
+            const uint8_t* block = padded_block(domain, data[l], len[l], b, blocks[l], scratch[l]);
+            for (int i = 0; i < 16; ++i) words[i][l] = sha256::load_be32(block + 4 * i);
+            active[l] = b < blocks[l] ? 0xffffffffu : 0u;
+        }
+
+        V w[64];
+        for (int i = 0; i < 16; ++i) std::memcpy(&w[i], words[i], sizeof(V));
+        for (int i = 16; i < 64; ++i) {
+            V s0 = MERKLE_ROTR(w[i - 15], 7) ^ MERKLE_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            V s1 = MERKLE_ROTR(w[i - 2], 17) ^ MERKLE_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        V a = state[0], bb = state[1], c = state[2], d = state[3];
+        V e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; ++i) {
+            V t1 = h + (MERKLE_ROTR(e, 6) ^ MERKLE_ROTR(e, 11) ^ MERKLE_ROTR(e, 25)) + ((e & f) ^ (~e & g)) +
+                   sha256::kRoundConstants[i] + w[i];
+            V t2 = (MERKLE_ROTR(a, 2) ^ MERKLE_ROTR(a, 13) ^ MERKLE_ROTR(a, 22)) + ((a & bb) ^ (a & c) ^ (bb & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = bb; bb = a; a = t1 + t2;
+        }
+        // 已經處理完所有區塊的 lane 保持原狀態
+        state[0] += a & active; state[1] += bb & active; state[2] += c & active; state[3] += d & active;
+        state[4] += e & active; state[5] += f & active; state[6] += g & active; state[7] += h & active;
+    }
+
+    for (int l = 0; l < Lanes; ++l) {
+        for (int i = 0; i < 8; ++i) sha256::store_be32(out[l].data() + 4 * i, state[i][l]);
+    }
+}
+
+#undef MERKLE_ROTR
+
+inline void hash_x4_sse2(uint8_t domain, const uint8_t* const* data, const size_t* len, Digest* out) {
+    hash_lanes<4>(domain, data, len, out);
+}
+
+__attribute__((target("avx2")))
+inline void hash_x8_avx2(uint8_t domain, const uint8_t* const* data, const size_t* len, Digest* out) {
+    hash_lanes<8>(domain, data, len, out);
+}
+
+__attribute__((target("avx512f")))
+inline void hash_x16_avx512(uint8_t domain, const uint8_t* const* data, const size_t* len, Digest* out) {
+    hash_lanes<16>(domain, data, len, out);
+}
+#endif
+
+inline void hash_x1_scalar(uint8_t domain, const uint8_t* const* data, const size_t* len, Digest* out) {
+    if (domain == kNodePrefix && len[0] == 64) {
+        Digest left, right;
+        std::memcpy(left.data(), data[0], 32);
+        std::memcpy(right.data(), data[0] + 32, 32);
+        out[0] = hash_node(left, right);
+        return;
+    }
+    sha256::Hasher h;
+    h.update(&domain, 1);
+    h.update(data[0], len[0]);
+    out[0] = h.finish();
+}
+
+} // namespace leaf_simd
+
+// 多緩衝雜湊核心：每次呼叫對恰好 lanes 則訊息計算 SHA-256(domain || data)
+struct LeafHashKernel {
+    const char* name;
+    size_t lanes;
+    void (*hash)(uint8_t domain, const uint8_t* const* data, const size_t* len, Digest* out);
+    bool supported;
+};
+
+// 所有核心 (含目前 CPU 不支援的)，依 lane 數遞增
+inline std::vector<LeafHashKernel> leaf_hash_kernels() {
+    std::vector<LeafHashKernel> kernels;
+    kernels.push_back({"scalar", 1, leaf_simd::hash_x1_scalar, true});
+#if MERKLE_HAS_SIMD_KERNELS
+    kernels.push_back({"sse2 x4", 4, leaf_simd::hash_x4_sse2, true});
+    kernels.push_back({"avx2 x8", 8, leaf_simd::hash_x8_avx2, __builtin_cpu_supports("avx2") != 0});
+    kernels.push_back({"avx512 x16", 16, leaf_simd::hash_x16_avx512, __builtin_cpu_supports("avx512f") != 0});
+#endif
+    return kernels;
+}
+
+// 執行期分派：第一次呼叫時挑選 CPU 支援的最寬核心
+inline const LeafHashKernel& best_leaf_hash_kernel() {
+    static const LeafHashKernel best = [] {
+        LeafHashKernel chosen = leaf_hash_kernels()[0];
+        for (const auto& k : leaf_hash_kernels()) {
+            if (k.supported) chosen = k;
+        }
+        return chosen;
+    }();
+    return best;
+}
+
+// 以指定核心雜湊 n 則訊息；不滿一組的尾端用最後一則補齊 lane，多出的結果丟棄
+inline void hash_messages(const LeafHashKernel& kernel, uint8_t domain, const uint8_t* const* data,
+                          const size_t* len, size_t n, Digest* out) {
+    size_t i = 0;
+    for (; i + kernel.lanes <= n; i += kernel.lanes) kernel.hash(domain, data + i, len + i, out + i);
+    if (i == n) return;
+
+    const uint8_t* tail_data[16];
+    size_t tail_len[16];
+    Digest tail_out[16];
+    for (size_t l = 0; l < kernel.lanes; ++l) {
+        size_t src = std::min(i + l, n - 1);
+        tail_data[l] = data[src];
+        tail_len[l] = len[src];
+    }
+    kernel.hash(domain, tail_data, tail_len, tail_out);
+    std::copy(tail_out, tail_out + (n - i), out + i);
+}
+
+inline void hash_leaves(const LeafHashKernel& kernel, const uint8_t* const* data, const size_t* len, size_t n,
+                        Digest* out) {
+    hash_messages(kernel, kLeafPrefix, data, len, n, out);
+}
+
+inline void hash_leaves(const uint8_t* const* data, const size_t* len, size_t n, Digest* out) {
+    hash_leaves(best_leaf_hash_kernel(), data, len, n, out);
+}
+
+// 同一層相鄰兩個摘要在連續陣列中正好是 left || right 的 64 位元組，
+// 所以 pairs 個父節點可以直接交給同一個多緩衝核心：out[i] = hash_node(level[2i], level[2i+1])
+inline void hash_node_pairs(const Digest* level, size_t pairs, Digest* out) {
+    const size_t kBatch = 64;
+    const uint8_t* batch_data[kBatch];
+    size_t batch_len[kBatch];
+    std::fill(batch_len, batch_len + kBatch, size_t(64));
+    for (size_t i = 0; i < pairs; i += kBatch) {
+        size_t count = std::min(kBatch, pairs - i);
+        for (size_t j = 0; j < count; ++j) batch_data[j] = level[2 * (i + j)].data();
+        hash_messages(best_leaf_hash_kernel(), kNodePrefix, batch_data, batch_len, count, out + i);
+    }
+}
+
+// 證明與同步訊息共用的 LEB128 varint 編碼
+namespace wire {
+
+inline void put_varint(std::string& out, uint64_t v) {
+    do {
+        uint8_t byte = v & 0x7f;
+        v >>= 7;
+        out.push_back(char(v ? (byte | 0x80) : byte));
+    } while (v);
+}
+
+inline uint64_t get_varint(const std::string& in, size_t& pos) {
+    uint64_t v = 0;
+    for (int shift = 0;; shift += 7) {
+        if (pos >= in.size() || shift > 63) throw std::invalid_argument("wire: bad varint");
+        uint8_t byte = uint8_t(in[pos++]);
+        v |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return v;
+    }
+}
+
+} // namespace wire
+
+// 包含證明 (inclusion proof)：從葉節點到根路徑上的兄弟摘要，由下往上排列。
+// 最右端與自身配對的節點沒有兄弟，不放入證明；驗證端可由 leaf_count 推得這些位置。
+struct MerkleProof {
+    uint64_t leaf_count = 0;
+    std::vector<Digest> siblings;
+
+    static const uint8_t kFormatVersion = 1;
+
+    // 序列化格式：[版本 1B][leaf_count, LEB128 varint][兄弟摘要 32B × k]，k 由剩餘長度決定
+    std::string serialize() const {
+        std::string out;
+        out.reserve(1 + 10 + siblings.size() * 32);
+        out.push_back(char(kFormatVersion));
+        wire::put_varint(out, leaf_count);
+        for (const auto& d : siblings) out.append(reinterpret_cast<const char*>(d.data()), d.size());
+        return out;
+    }
+
+    static MerkleProof parse(const std::string& bytes) {
+        if (bytes.empty() || uint8_t(bytes[0]) != kFormatVersion) {
+            throw std::invalid_argument("MerkleProof::parse: unknown format version");
+        }
+        MerkleProof proof;
+        size_t pos = 1;
+        proof.leaf_count = wire::get_varint(bytes, pos);
+        if ((bytes.size() - pos) % 32 != 0) throw std::invalid_argument("MerkleProof::parse: truncated digest");
+        proof.siblings.resize((bytes.size() - pos) / 32);
+        for (auto& d : proof.siblings) {
+            std::memcpy(d.data(), bytes.data() + pos, 32);
+            pos += 32;
+        }
+        return proof;
+    }
+};
+
+// 差異比對的結果：[begin, end) 區間內的資料塊與對方不同
+struct BlockRange {
+    size_t begin;
+    size_t end;
+    bool operator==(const BlockRange& other) const { return begin == other.begin && end == other.end; }
+};
+
+// 反熵 (anti-entropy) 同步的請求/回應格式，所有整數皆為 LEB128 varint：
+//   kSyncInfo   請求 [type]                               回應 [leaf_count]
+//   kSyncHashes 請求 [type][level][count][index 差值 × count]  回應 [32B 摘要 × count]
+namespace merkle_sync {
+
+static const uint8_t kSyncInfo = 1;
+static const uint8_t kSyncHashes = 2;
+
+} // namespace merkle_sync
+
+// 一次請求/回應的往返，實際部署時背後是 RPC 或 socket
+using SyncRoundTrip = std::function<std::string(const std::string& request)>;
+
 // 解答 (Solution)
 class MerkleTree {
 private:
     std::vector<std::string> data_blocks;
-    std::string root_hash;
+    // levels[0] 為葉節點，levels.back() 只有根；每一層是一段連續的摘要陣列
+    std::vector<std::vector<Digest>> levels;
+
+    // 平行建構時每個子樹至少 2^8 個葉節點
+    static const size_t kMinSubtreeHeight = 8;
 
-    // 模擬的雜湊函式，將輸入字串轉換為其雜湊值的字串表示
-    std::string hash_function(const std::string& s) {
-        return std::to_string(std::hash<std::string>{}(s));
+    // 依葉節點數配置每一層 (level j 有 ceil(n / 2^j) 個節點)，之後各執行緒只寫入自己的區段
+    void allocate_levels(size_t leaf_count) {
+        levels.clear();
+        size_t count = leaf_count;
+        while (true) {
+            levels.emplace_back(count);
+            if (count == 1) break;
+            count = (count + 1) / 2;
+        }
     }
 
-    void build_tree() {
-        if (data_blocks.empty()) {
-            root_hash = "";
-            return;
+    // 計算 levels[0][begin, end) 的葉雜湊：每次收集 64 個葉節點交給多緩衝核心
+    void hash_leaf_range(size_t begin, size_t end) {
+        const size_t kBatch = 64;
+        const uint8_t* batch_data[kBatch];
+        size_t batch_len[kBatch];
+        for (size_t i = begin; i < end; i += kBatch) {
+            size_t count = std::min(kBatch, end - i);
+            for (size_t j = 0; j < count; ++j) {
+                batch_data[j] = reinterpret_cast<const uint8_t*>(data_blocks[i + j].data());
+                batch_len[j] = data_blocks[i + j].size();
+            }
+            hash_leaves(batch_data, batch_len, count, &levels[0][i]);
         }
+    }
 
-        std::vector<std::string> current_level_hashes;
-        // 計算葉節點層的雜湊
-        for (const auto& block : data_blocks) {
-            current_level_hashes.push_back(hash_function(block));
+    // 把 levels[from] 的 [begin, end) 向上歸約 height 層。begin 必須是 2^height 的倍數，
+    // 所以區段內的配對與整棵樹相同；只有整層最右端的區段才會遇到奇數節點
+    void reduce_range(size_t from, size_t begin, size_t end, size_t height) {
+        for (size_t level = from; level < from + height; ++level) {
+            const std::vector<Digest>& current = levels[level];
+            std::vector<Digest>& next = levels[level + 1];
+            size_t pairs = (end - begin) / 2;
+            hash_node_pairs(&current[begin], pairs, &next[begin / 2]);
+            // 奇數節點：最後一個與自身配對
+            if ((end - begin) % 2 == 1) next[(end - 1) / 2] = hash_node(current[end - 1], current[end - 1]);
+            begin /= 2;
+            end = (end + 1) / 2;
         }
+    }
 
-        // 如果只有一個資料塊，其雜湊就是根雜湊
-        if (current_level_hashes.size() == 1) {
-            root_hash = current_level_hashes[0];
-            return;
+    // 以 levels[level][index] 及其兄弟重算父節點 (沒有兄弟時與自身配對)
+    void rehash_parent(size_t level, size_t index) {
+        const std::vector<Digest>& current = levels[level];
+        size_t left = index & ~size_t(1);
+        const Digest& right = (left + 1 < current.size()) ? current[left + 1] : current[left];
+        levels[level + 1][left / 2] = hash_node(current[left], right);
+    }
+
+    // 對方節點摘要的來源：給定層與遞增的索引，回傳對方在這些位置的摘要
+    using RemoteHashes = std::function<std::vector<Digest>(size_t level, const std::vector<size_t>& indices)>;
+
+    // n 個葉節點的樹在第 level 層的節點數 (n > 0)
+    static size_t level_size(uint64_t leaf_count, size_t level) {
+        return size_t(((leaf_count - 1) >> level) + 1);
+    }
+
+    static size_t level_count(uint64_t leaf_count) {
+        size_t count = 1;
+        while (level_size(leaf_count, count - 1) > 1) ++count;
+        return count;
+    }
+
+    // 由上往下逐層比對：只對摘要不同的節點展開子節點，每層只向對方要一次摘要。
+    // 兩邊大小不同時從兩棵樹共有的最高層開始，多出來的尾端整段視為差異
+    std::vector<BlockRange> diff_walk(uint64_t other_leaf_count, const RemoteHashes& fetch) const {
+        const uint64_t n = data_blocks.size(), m = other_leaf_count;
+        std::vector<BlockRange> ranges;
+        if (n == 0 || m == 0) {
+            if (n != m) ranges.push_back({0, size_t(std::max(n, m))});
+            return ranges;
         }
 
-        // 逐層向上建構
-        while (current_level_hashes.size() > 1) {
-            std::vector<std::string> next_level_hashes;
-            for (size_t i = 0; i < current_level_hashes.size(); i += 2) {
-                if (i + 1 < current_level_hashes.size()) {
-                    // 將相鄰兩個雜湊串接後再雜湊
-                    next_level_hashes.push_back(hash_function(current_level_hashes[i] + current_level_hashes[i+1]));
-                } else {
-                    // 處理奇數節點的情況
-                    next_level_hashes.push_back(hash_function(current_level_hashes[i] + current_level_hashes[i]));
+        size_t start = std::min(levels.size(), level_count(m)) - 1;
+        std::vector<size_t> candidates(std::min(levels[start].size(), level_size(m, start)));
+        for (size_t i = 0; i < candidates.size(); ++i) candidates[i] = i;
+
+        std::vector<size_t> changed;
+        for (size_t level = start + 1; level-- > 0 && !candidates.empty();) {
+            std::vector<Digest> remote = fetch(level, candidates);
+            if (remote.size() != candidates.size()) throw std::runtime_error("MerkleTree::diff: short response");
+            std::vector<size_t> next;
+            const size_t child_limit = level > 0 ? std::min(levels[level - 1].size(), level_size(m, level - 1)) : 0;
+            for (size_t k = 0; k < candidates.size(); ++k) {
+                size_t i = candidates[k];
+                if (levels[level][i] == remote[k]) continue;
+                if (level == 0) {
+                    changed.push_back(i);
+                    continue;
                 }
+                next.push_back(2 * i);
+                if (2 * i + 1 < child_limit) next.push_back(2 * i + 1);
             }
-            current_level_hashes = next_level_hashes;
+            candidates.swap(next);
         }
 
-        root_hash = current_level_hashes[0];
+        // 逐層展開保持由左到右的順序，相鄰的葉節點合併成區間
+        for (size_t i : changed) {
+            if (!ranges.empty() && ranges.back().end == i) {
+                ++ranges.back().end;
+            } else {
+                ranges.push_back({i, i + 1});
+            }
+        }
+        if (n != m) {
+            size_t common = size_t(std::min(n, m));
+            if (!ranges.empty() && ranges.back().end == common) {
+                ranges.back().end = size_t(std::max(n, m));
+            } else {
+                ranges.push_back({common, size_t(std::max(n, m))});
+            }
+        }
+        return ranges;
+    }
+
+    void build_tree(unsigned threads) {
+        levels.clear();
+        if (data_blocks.empty()) return;
+
+        const size_t n = data_blocks.size();
+        allocate_levels(n);
+        const size_t top = levels.size() - 1;
+
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        // 子樹高度 k：每塊 2^k 個葉節點 (至少 2^kMinSubtreeHeight)，塊數約為執行緒數的 4 倍以平衡負載
+        size_t height = top < kMinSubtreeHeight ? top : kMinSubtreeHeight;
+        while (height < top && ((n - 1) >> height) + 1 > size_t(threads) * 4) ++height;
+        const size_t chunk_count = ((n - 1) >> height) + 1;
+
+        if (threads == 1 || chunk_count == 1) {
+            hash_leaf_range(0, n);
+            reduce_range(0, 0, n, top);
+            return;
+        }
+
+        // 各執行緒以原子計數器領取子樹：葉雜湊 + 歸約 k 層，全程沒有逐層的 barrier
+        std::atomic<size_t> next_chunk(0);
+        auto worker = [&] {
+            for (size_t c = next_chunk.fetch_add(1); c < chunk_count; c = next_chunk.fetch_add(1)) {
+                size_t begin = c << height;
+                size_t end = std::min(n, begin + (size_t(1) << height));
+                hash_leaf_range(begin, end);
+                reduce_range(0, begin, end, height);
+            }
+        };
+        std::vector<std::thread> pool;
+        for (unsigned t = 1; t < std::min<size_t>(threads, chunk_count); ++t) pool.emplace_back(worker);
+        worker();
+        for (auto& t : pool) t.join();
+
+        // 子樹根 (level k) 以上只剩 chunk_count 個節點，單執行緒合併
+        reduce_range(height, 0, chunk_count, top - height);
     }
 
 public:
-    MerkleTree(const std::vector<std::string>& blocks) : data_blocks(blocks) {
-        build_tree();
+    // threads = 0 表示使用所有核心；任何執行緒數都產生與單執行緒相同的根
+    MerkleTree(const std::vector<std::string>& blocks, unsigned threads = 1) : data_blocks(blocks) {
+        build_tree(threads);
+    }
+
+    bool empty() const { return levels.empty(); }
+
+    // 原始 32 位元組根摘要；空樹回傳全 0
+    Digest root() const {
+        return levels.empty() ? Digest{} : levels.back()[0];
     }
 
     std::string getRootHash() const {
-        return root_hash;
+        return levels.empty() ? std::string() : to_hex(root());
+    }
+
+    size_t size() const { return data_blocks.size(); }
+
+    // 單一資料塊更新：只重算該葉節點到根的路徑，O(log n) 次雜湊
+    void update(size_t index, const std::string& new_block) {
+        if (index >= data_blocks.size()) throw std::out_of_range("MerkleTree::update: index out of range");
+        data_blocks[index] = new_block;
+        levels[0][index] = hash_leaf(new_block.data(), new_block.size());
+        for (size_t level = 0; level + 1 < levels.size(); ++level) {
+            rehash_parent(level, index);
+            index /= 2;
+        }
+    }
+
+    // 批次更新：先換掉所有葉節點，再逐層只重算「髒」的父節點，共同祖先只算一次。
+    // 回傳重算的內部節點數
+    size_t update(const std::vector<std::pair<size_t, std::string>>& updates) {
+        std::vector<size_t> dirty;
+        dirty.reserve(updates.size());
+        for (const auto& u : updates) {
+            if (u.first >= data_blocks.size()) throw std::out_of_range("MerkleTree::update: index out of range");
+        }
+        for (const auto& u : updates) {
+            data_blocks[u.first] = u.second;
+            levels[0][u.first] = hash_leaf(u.second.data(), u.second.size());
+            dirty.push_back(u.first);
+        }
+        std::sort(dirty.begin(), dirty.end());
+
+        size_t rehashed = 0;
+        for (size_t level = 0; level + 1 < levels.size(); ++level) {
+            // 兄弟節點 (2k, 2k+1) 對應同一個父節點，排序後相鄰去重
+            size_t out = 0;
+            for (size_t i = 0; i < dirty.size(); ++i) {
+                size_t parent = dirty[i] / 2;
+                if (out > 0 && dirty[out - 1] == parent) continue;
+                rehash_parent(level, dirty[i]);
+                dirty[out++] = parent;
+                ++rehashed;
+            }
+            dirty.resize(out);
+        }
+        return rehashed;
+    }
+
+    // 追加資料塊 (例如持續成長的日誌)：新葉節點到根的路徑就是唯一受影響的節點，
+    // 原本奇數配對自身的最右節點，其父節點也在這條路徑上；樹長高時在頂端多加一層
+    void append(const std::string& block) {
+        data_blocks.push_back(block);
+        Digest leaf = hash_leaf(block.data(), block.size());
+        if (levels.empty()) {
+            levels.emplace_back(1, leaf);
+            return;
+        }
+        levels[0].push_back(leaf);
+        size_t index = levels[0].size() - 1;
+        for (size_t level = 0; levels[level].size() > 1; ++level) {
+            if (level + 1 == levels.size()) levels.emplace_back();
+            levels[level + 1].resize((levels[level].size() + 1) / 2);
+            rehash_parent(level, index);
+            index /= 2;
+        }
+    }
+
+    // 產生第 index 個資料塊的包含證明：每層取兄弟節點 (若存在)，共至多 ceil(log2 n) 個摘要
+    MerkleProof prove(size_t index) const {
+        if (index >= data_blocks.size()) throw std::out_of_range("MerkleTree::prove: index out of range");
+        MerkleProof proof;
+        proof.leaf_count = data_blocks.size();
+        for (size_t level = 0; level + 1 < levels.size(); ++level) {
+            size_t sibling = index ^ 1;
+            if (sibling < levels[level].size()) proof.siblings.push_back(levels[level][sibling]);
+            index /= 2;
+        }
+        return proof;
+    }
+
+    const std::string& block(size_t index) const { return data_blocks.at(index); }
+
+    // 與另一棵樹比對，回傳內容不同的資料塊區間；只走進摘要不同的子樹
+    std::vector<BlockRange> diff(const MerkleTree& other) const {
+        return diff_walk(other.size(), [&other](size_t level, const std::vector<size_t>& indices) {
+            std::vector<Digest> hashes;
+            hashes.reserve(indices.size());
+            for (size_t i : indices) hashes.push_back(other.levels[level][i]);
+            return hashes;
+        });
     }
 
-    // 驗證函式：比較當前樹的根雜湊與另一組資料產生的根雜湊是否相同
+    // 同步的伺服端：回應對方的 kSyncInfo / kSyncHashes 請求
+    std::string handle_sync_request(const std::string& request) const {
+        if (request.empty()) throw std::invalid_argument("MerkleTree::handle_sync_request: empty request");
+        std::string response;
+        size_t pos = 1;
+        if (uint8_t(request[0]) == merkle_sync::kSyncInfo) {
+            wire::put_varint(response, data_blocks.size());
+        } else if (uint8_t(request[0]) == merkle_sync::kSyncHashes) {
+            uint64_t level = wire::get_varint(request, pos);
+            uint64_t count = wire::get_varint(request, pos);
+            if (level >= levels.size() || count > levels[level].size()) {
+                throw std::invalid_argument("MerkleTree::handle_sync_request: bad level");
+            }
+            response.reserve(count * 32);
+            uint64_t index = 0;
+            for (uint64_t k = 0; k < count; ++k) {
+                index += wire::get_varint(request, pos);
+                if (index >= levels[level].size()) {
+                    throw std::invalid_argument("MerkleTree::handle_sync_request: index out of range");
+                }
+                const Digest& d = levels[level][index];
+                response.append(reinterpret_cast<const char*>(d.data()), d.size());
+            }
+        } else {
+            throw std::invalid_argument("MerkleTree::handle_sync_request: unknown request type");
+        }
+        return response;
+    }
+
+    // 同步的客戶端：透過請求/回應與遠端比對，每層一次往返，交換 O(差異數 × log n) 個摘要
+    std::vector<BlockRange> diff_remote(const SyncRoundTrip& round_trip) const {
+        std::string info = round_trip(std::string(1, char(merkle_sync::kSyncInfo)));
+        size_t pos = 0;
+        uint64_t other_leaf_count = wire::get_varint(info, pos);
+
+        return diff_walk(other_leaf_count, [&round_trip](size_t level, const std::vector<size_t>& indices) {
+            std::string request(1, char(merkle_sync::kSyncHashes));
+            wire::put_varint(request, level);
+            wire::put_varint(request, indices.size());
+            size_t previous = 0;
+            for (size_t i : indices) {
+                wire::put_varint(request, i - previous); // 索引遞增，只送差值
+                previous = i;
+            }
+            std::string response = round_trip(request);
+            if (response.size() != indices.size() * 32) throw std::runtime_error("MerkleTree::diff_remote: bad response");
+            std::vector<Digest> hashes(indices.size());
+            for (size_t k = 0; k < hashes.size(); ++k) std::memcpy(hashes[k].data(), response.data() + 32 * k, 32);
+            return hashes;
+        });
+    }
+
+    // 驗證函式：比較另一組資料是否與當前樹相同。
+    // 保留了葉節點層，所以只要逐一比對葉雜湊 (遇到第一個不同就停)，不需要再建一整棵樹
     bool verify(const std::vector<std::string>& new_blocks) const {
-        MerkleTree new_tree(new_blocks);
-        return new_tree.getRootHash() == this->root_hash;
+        if (new_blocks.size() != data_blocks.size()) return false;
+        const size_t kBatch = 64;
+        const uint8_t* batch_data[kBatch];
+        size_t batch_len[kBatch];
+        Digest batch_out[kBatch];
+        for (size_t i = 0; i < new_blocks.size(); i += kBatch) {
+            size_t count = std::min(kBatch, new_blocks.size() - i);
+            for (size_t j = 0; j < count; ++j) {
+                batch_data[j] = reinterpret_cast<const uint8_t*>(new_blocks[i + j].data());
+                batch_len[j] = new_blocks[i + j].size();
+            }
+            hash_leaves(batch_data, batch_len, count, batch_out);
+            if (!std::equal(batch_out, batch_out + count, levels[0].begin() + i)) return false;
+        }
+        return true;
     }
 };
 
+// 獨立的證明驗證：只需要資料塊本身、索引、證明與可信的根，O(log n) 次雜湊，不需要整份資料集。
+// 注意 leaf_count 必須與根一起由可信來源取得 (如 RFC 6962 的 tree_size)：
+// 奇數節點與自身配對時，[A, B, C] 與 [A, B, C, C] 的根相同，單憑根無法區分兩者
+inline bool verify_proof(const std::string& leaf, uint64_t index, const MerkleProof& proof, const Digest& root) {
+    if (index >= proof.leaf_count) return false;
+    Digest hash = hash_leaf(leaf.data(), leaf.size());
+    size_t used = 0;
+    for (uint64_t count = proof.leaf_count; count > 1; count = (count + 1) / 2, index /= 2) {
+        if (index % 2 == 1) {
+            if (used == proof.siblings.size()) return false;
+            hash = hash_node(proof.siblings[used++], hash);
+        } else if (index + 1 < count) {
+            if (used == proof.siblings.size()) return false;
+            hash = hash_node(hash, proof.siblings[used++]);
+        } else {
+            hash = hash_node(hash, hash); // 最右端的奇數節點
+        }
+    }
+    return used == proof.siblings.size() && hash == root;
+}
+
+// 串流建構：依序餵入葉雜湊，只保留每層至多一個尚未配對的節點 (像二進位計數器的進位)，
+// 記憶體 O(樹高)；finish() 的根與 MerkleTree 對同一串資料塊建出的根相同
+class MerkleStreamBuilder {
+private:
+    std::vector<Digest> pending;        // pending[j]：第 j 層等待右兄弟的節點
+    std::vector<uint8_t> has_pending;
+    uint64_t leaves = 0;
+
+public:
+    void add_leaf_digest(const Digest& leaf) {
+        Digest node = leaf;
+        size_t level = 0;
+        for (; level < pending.size() && has_pending[level]; ++level) {
+            node = hash_node(pending[level], node);
+            has_pending[level] = 0;
+        }
+        if (level == pending.size()) {
+            pending.push_back(node);
+            has_pending.push_back(1);
+        } else {
+            pending[level] = node;
+            has_pending[level] = 1;
+        }
+        ++leaves;
+    }
+
+    uint64_t leaf_count() const { return leaves; }
+
+    // 保留的節點數 (<= 樹高 + 1)
+    size_t frontier_size() const { return pending.size(); }
+
+    // 由下往上收尾：每層最右端若沒有兄弟就與自身配對 (同 build_tree 的奇數規則)
+    Digest finish() const {
+        if (leaves == 0) return Digest{};
+        Digest carry{};
+        bool has_carry = false;
+        size_t level = 0;
+        for (; ((leaves - 1) >> level) > 0; ++level) { // 此層節點數 > 1
+            bool left = level < pending.size() && has_pending[level];
+            if (left && has_carry) {
+                carry = hash_node(pending[level], carry);
+            } else if (left) {
+                carry = hash_node(pending[level], pending[level]);
+                has_carry = true;
+            } else if (has_carry) {
+                carry = hash_node(carry, carry);
+            }
+        }
+        return has_carry ? carry : pending[level];
+    }
+};
+
+struct FileMerkleSummary {
+    Digest root;
+    uint64_t leaf_count;
+    uint64_t bytes;
+    size_t frontier_size;
+};
+
+// 單一葉節點在檔案中的位置與雜湊，供去重或同步使用
+struct ChunkRecord {
+    uint64_t offset;
+    uint32_t length;
+    Digest digest;
+};
+
+// 切塊策略的介面：cut(data, len, eof) 回傳從 data 開始的下一塊長度；
+// 若需要更多資料才能決定 (且尚未到檔尾) 則回傳 0。
+// 固定大小切塊：每 block_size 位元組一塊，最後一塊可以較短
+class FixedSizeChunker {
+private:
+    size_t block_size;
+
+public:
+    explicit FixedSizeChunker(size_t size) : block_size(size) {
+        if (size == 0) throw std::invalid_argument("FixedSizeChunker: block_size must be positive");
+    }
+
+    size_t max_size() const { return block_size; }
+
+    size_t cut(const uint8_t*, size_t len, bool eof) const {
+        if (len >= block_size) return block_size;
+        return eof ? len : 0;
+    }
+};
+
+// 內容定義切塊 (FastCDC)：以 gear hash h = (h << 1) + gear[byte] 滾動，h 的高位元只受最近 64 個位元組影響，
+// 遇到高 N 位全為 0 的位置就切。切點由內容決定，插入或刪除位元組只會改變附近的一兩塊。
+// - 前 min_size 位元組直接跳過 (不可能切)，這也是 FastCDC 快的主要原因之一
+// - 正規化切塊：avg 之前用較嚴格的遮罩 (log2(avg) + 2 位)、之後用較寬鬆的 (log2(avg) - 2 位)，塊大小集中在 avg 附近
+// - 到 max_size 仍未遇到切點就強制切
+class FastCdcChunker {
+private:
+    size_t min_chunk, avg_chunk, max_chunk;
+    uint64_t mask_small, mask_large;
+
+    // 256 個固定的 64 位元隨機數 (splitmix64)，兩端使用同一張表切點才會一致
+    static const uint64_t* gear_table() {
+        static const std::array<uint64_t, 256> table = [] {
+            std::array<uint64_t, 256> t;
+            uint64_t state = 0x6d65726b6c654344ULL;
+            for (auto& v : t) {
+                uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+                v = z ^ (z >> 31);
+            }
+            return t;
+        }();
+        return table.data();
+    }
+
+    static uint64_t top_bits_mask(int bits) { return bits <= 0 ? 0 : ~uint64_t(0) << (64 - bits); }
+
+public:
+    FastCdcChunker(size_t min_size, size_t avg_size, size_t max_size)
+        : min_chunk(min_size), avg_chunk(avg_size), max_chunk(max_size) {
+        if (min_size == 0 || min_size > avg_size || avg_size > max_size) {
+            throw std::invalid_argument("FastCdcChunker: require 0 < min <= avg <= max");
+        }
+        int bits = 0;
+        while ((size_t(1) << (bits + 1)) <= avg_size) ++bits; // floor(log2(avg))
+        mask_small = top_bits_mask(bits + 2);
+        mask_large = top_bits_mask(bits - 2);
+    }
+
+    size_t min_size() const { return min_chunk; }
+    size_t avg_size() const { return avg_chunk; }
+    size_t max_size() const { return max_chunk; }
+
+    size_t cut(const uint8_t* data, size_t len, bool eof) const {
+        if (len <= min_chunk) return eof ? len : 0;
+        const uint64_t* gear = gear_table();
+        const size_t limit = std::min(len, max_chunk);
+        const size_t normal = std::min(avg_chunk, limit);
+        uint64_t h = 0;
+        size_t i = min_chunk;
+        for (; i < normal; ++i) {
+            h = (h << 1) + gear[data[i]];
+            if (!(h & mask_small)) return i + 1;
+        }
+        for (; i < limit; ++i) {
+            h = (h << 1) + gear[data[i]];
+            if (!(h & mask_large)) return i + 1;
+        }
+        if (limit == max_chunk) return max_chunk;
+        return eof ? len : 0;
+    }
+
+    // 整段記憶體的切塊長度
+    std::vector<size_t> chunk_lengths(const uint8_t* data, size_t len) const {
+        std::vector<size_t> lengths;
+        for (size_t offset = 0; offset < len;) {
+            size_t n = cut(data + offset, len - offset, true);
+            lengths.push_back(n);
+            offset += n;
+        }
+        return lengths;
+    }
+};
+
+// 依 chunker 切塊計算檔案的默克爾根，資料不複製成 std::string：
+// - use_mmap (一般檔案)：每次映射約 64 MiB 的視窗，直接在映射的頁面上做多緩衝葉雜湊，用完即 munmap；
+//   跨越視窗尾端的塊 (可變大小切塊才會有) 從下一個視窗的開頭重新處理
+// - 否則 (或非一般檔案，如 pipe)：以大的 read() 填滿緩衝區再雜湊，未切完的尾端搬到緩衝區開頭
+// chunks 非空時記錄每一塊的位置與雜湊。失敗時丟出 std::system_error
+template <class Chunker>
+FileMerkleSummary hash_file_chunked(const std::string& path, const Chunker& chunker, bool use_mmap = true,
+                                    std::vector<ChunkRecord>* chunks = nullptr) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) throw std::system_error(errno, std::generic_category(), "open " + path);
+    struct FdGuard {
+        int fd;
+        ~FdGuard() { ::close(fd); }
+    } guard{fd};
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) throw std::system_error(errno, std::generic_category(), "fstat " + path);
+
+    MerkleStreamBuilder builder;
+    uint64_t total = 0;
+    // 切出 [data, data + len) 中所有能確定的塊，每次 64 個交給多緩衝核心；回傳已消耗的位元組數
+    auto hash_span = [&](const uint8_t* data, size_t len, bool eof) {
+        const size_t kBatch = 64;
+        const uint8_t* batch_data[kBatch];
+        size_t batch_len[kBatch];
+        Digest batch_out[kBatch];
+        size_t offset = 0;
+        bool more = true;
+        while (more) {
+            size_t count = 0;
+            while (count < kBatch && offset < len) {
+                size_t n = chunker.cut(data + offset, len - offset, eof);
+                if (n == 0) break;
+                batch_data[count] = data + offset;
+                batch_len[count++] = n;
+                offset += n;
+            }
+            more = count == kBatch;
+            hash_leaves(batch_data, batch_len, count, batch_out);
+            for (size_t i = 0; i < count; ++i) {
+                builder.add_leaf_digest(batch_out[i]);
+                if (chunks) chunks->push_back({total, uint32_t(batch_len[i]), batch_out[i]});
+                total += batch_len[i];
+            }
+        }
+        return offset;
+    };
+
+    const size_t window = std::max<size_t>(size_t(64) << 20, 2 * chunker.max_size());
+    if (use_mmap && S_ISREG(st.st_mode)) {
+        const uint64_t file_size = uint64_t(st.st_size);
+        const uint64_t page = uint64_t(::sysconf(_SC_PAGESIZE));
+        for (uint64_t offset = 0; offset < file_size;) {
+            // 映射起點需要對齊頁面，從前一個頁面邊界開始映射
+            uint64_t aligned = offset / page * page;
+            size_t len = size_t(std::min<uint64_t>(window, file_size - offset));
+            size_t map_len = size_t(offset - aligned) + len;
+            void* base = ::mmap(nullptr, map_len, PROT_READ, MAP_PRIVATE, fd, off_t(aligned));
+            if (base == MAP_FAILED) throw std::system_error(errno, std::generic_category(), "mmap " + path);
+            ::madvise(base, map_len, MADV_SEQUENTIAL);
+            offset += hash_span(static_cast<const uint8_t*>(base) + (offset - aligned), len, offset + len == file_size);
+            ::munmap(base, map_len);
+        }
+    } else {
+        std::unique_ptr<uint8_t[]> buffer(new uint8_t[window]);
+        size_t filled = 0;
+        bool eof = false;
+        while (!eof) {
+            // pipe 可能每次只回傳一部分，填滿整個緩衝區 (或讀到 EOF) 再切塊，切點才與 mmap 版本相同
+            while (filled < window) {
+                ssize_t n = ::read(fd, buffer.get() + filled, window - filled);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    throw std::system_error(errno, std::generic_category(), "read " + path);
+                }
+                if (n == 0) {
+                    eof = true;
+                    break;
+                }
+                filled += size_t(n);
+            }
+            size_t consumed = hash_span(buffer.get(), filled, eof);
+            std::memmove(buffer.get(), buffer.get() + consumed, filled - consumed);
+            filled -= consumed;
+        }
+    }
+    return FileMerkleSummary{builder.finish(), builder.leaf_count(), total, builder.frontier_size()};
+}
+
+// 固定大小切塊的檔案默克爾根
+inline FileMerkleSummary hash_file(const std::string& path, size_t block_size, bool use_mmap = true) {
+    return hash_file_chunked(path, FixedSizeChunker(block_size), use_mmap);
+}
+
+// SHA-256 測試向量、節點快速路徑與網域分隔
+void test_hash_primitives() {
+    std::cout << "\n--- Hash Primitives ---" << std::endl;
+
+    struct Vector { std::string input; const char* expected; };
+    const Vector vectors[] = {
+        {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+        {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+         "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+        {std::string(1000000, 'a'), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+    };
+    bool vectors_ok = true;
+    for (const auto& v : vectors) {
+        vectors_ok = vectors_ok && to_hex(sha256::digest(v.input.data(), v.input.size())) == v.expected;
+    }
+    // 逐位元組餵入的串流結果須與一次餵入相同
+    std::string text = "The quick brown fox jumps over the lazy dog, again and again and again.";
+    sha256::Hasher streamed;
+    for (char c : text) streamed.update(&c, 1);
+    vectors_ok = vectors_ok && streamed.finish() == sha256::digest(text.data(), text.size());
+    std::cout << "SHA-256 test vectors: " << (vectors_ok ? "(passed)" : "(failed)") << std::endl;
+
+    // hash_node 快速路徑 == 通用 SHA-256(0x01 || left || right)
+    Digest left = sha256::digest("left", 4), right = sha256::digest("right", 5);
+    uint8_t concat[65];
+    concat[0] = kNodePrefix;
+    std::memcpy(concat + 1, left.data(), 32);
+    std::memcpy(concat + 33, right.data(), 32);
+    bool node_ok = hash_node(left, right) == sha256::digest(concat, sizeof(concat));
+    std::cout << "hash_node fast path matches generic SHA-256: " << (node_ok ? "(passed)" : "(failed)") << std::endl;
+
+    // 網域分隔：把內部節點的 64 位元組當成資料塊，葉雜湊也不會等於該內部節點
+    bool separated = hash_leaf(concat + 1, 64) != hash_node(left, right);
+    // 兩層的樹 {L, R} 與「把 left||right 當成單一資料塊」的單葉樹根不同
+    MerkleTree two({"L", "R"});
+    std::string forged(64, '\0');
+    Digest l = hash_leaf("L", 1), r = hash_leaf("R", 1);
+    std::memcpy(&forged[0], l.data(), 32);
+    std::memcpy(&forged[32], r.data(), 32);
+    MerkleTree one({forged});
+    separated = separated && two.root() != one.root();
+    std::cout << "Leaf/node domain separation: " << (separated ? "(passed)" : "(failed)") << std::endl;
+}
+
+// 每個核心對不同長度的葉節點都要與 hash_leaf 一致，並比較吞吐量
+void test_leaf_hash_kernels() {
+    std::cout << "\n--- Multi-buffer Leaf Hashing ---" << std::endl;
+    std::cout << "Dispatched kernel: " << best_leaf_hash_kernel().name << std::endl;
+
+    // 長度 0..299 的葉節點，涵蓋 1 到 6 個區塊與各種填充邊界
+    std::vector<std::string> varied;
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < 300; ++i) {
+        std::string block(i, '\0');
+        for (auto& c : block) {
+            seed = seed * 1664525u + 1013904223u;
+            c = char(seed >> 24);
+        }
+        varied.push_back(block);
+    }
+    std::vector<const uint8_t*> varied_data;
+    std::vector<size_t> varied_len;
+    std::vector<Digest> expected;
+    for (const auto& block : varied) {
+        varied_data.push_back(reinterpret_cast<const uint8_t*>(block.data()));
+        varied_len.push_back(block.size());
+        expected.push_back(hash_leaf(block.data(), block.size()));
+    }
+
+    // 16 MiB 的 1 KiB 葉節點做吞吐量測試
+    const size_t kLeafSize = 1024, kLeafCount = 16 * 1024;
+    std::vector<uint8_t> bulk(kLeafSize * kLeafCount);
+    for (auto& byte : bulk) {
+        seed = seed * 1664525u + 1013904223u;
+        byte = uint8_t(seed >> 24);
+    }
+    std::vector<const uint8_t*> bulk_data(kLeafCount);
+    std::vector<size_t> bulk_len(kLeafCount, kLeafSize);
+    for (size_t i = 0; i < kLeafCount; ++i) bulk_data[i] = bulk.data() + i * kLeafSize;
+
+    std::vector<Digest> reference;
+    double scalar_gbps = 0;
+    for (const auto& kernel : leaf_hash_kernels()) {
+        if (!kernel.supported) {
+            std::cout << kernel.name << ": not supported by this CPU" << std::endl;
+            continue;
+        }
+        std::vector<Digest> got(varied.size());
+        hash_leaves(kernel, varied_data.data(), varied_len.data(), varied.size(), got.data());
+        bool ok = got == expected;
+
+        std::vector<Digest> bulk_out(kLeafCount);
+        double best_seconds = 1e9;
+        for (int round = 0; round < 3; ++round) {
+            auto start = std::chrono::steady_clock::now();
+            hash_leaves(kernel, bulk_data.data(), bulk_len.data(), kLeafCount, bulk_out.data());
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            best_seconds = std::min(best_seconds, elapsed.count());
+        }
+        if (reference.empty()) reference = bulk_out;
+        ok = ok && bulk_out == reference;
+
+        double gbps = bulk.size() / best_seconds / 1e9;
+        if (scalar_gbps == 0) scalar_gbps = gbps;
+        std::cout << kernel.name << ": " << gbps << " GB/s (" << gbps / scalar_gbps << "x scalar) "
+                  << (ok ? "(passed)" : "(failed)") << std::endl;
+    }
+}
+
+// 平行建構的根必須與單執行緒完全相同，並量測不同執行緒數的建構時間
+void test_parallel_build() {
+    std::cout << "\n--- Parallel Build ---" << std::endl;
+
+    bool identical = true;
+    const size_t sizes[] = {1, 2, 3, 255, 256, 257, 1000, 4097, 65537};
+    for (size_t n : sizes) {
+        std::vector<std::string> blocks(n);
+        for (size_t i = 0; i < n; ++i) blocks[i] = "block-" + std::to_string(i);
+        Digest serial = MerkleTree(blocks, 1).root();
+        for (unsigned threads : {2u, 3u, 4u, 8u, 0u}) {
+            identical = identical && MerkleTree(blocks, threads).root() == serial;
+        }
+    }
+    std::cout << "Parallel roots match serial root for ragged sizes: " << (identical ? "(passed)" : "(failed)") << std::endl;
+
+    // 64 MiB：128K 個 512 位元組的資料塊
+    const size_t kBlockSize = 512, kBlockCount = 128 * 1024;
+    std::vector<std::string> blocks(kBlockCount, std::string(kBlockSize, '\0'));
+    uint32_t seed = 7;
+    for (auto& block : blocks) {
+        for (auto& c : block) {
+            seed = seed * 1664525u + 1013904223u;
+            c = char(seed >> 24);
+        }
+    }
+    std::cout << "Hardware threads: " << std::thread::hardware_concurrency() << std::endl;
+    Digest expected{};
+    double serial_seconds = 0;
+    bool same_root = true;
+    for (unsigned threads : {1u, 2u, 4u, 8u}) {
+        auto start = std::chrono::steady_clock::now();
+        MerkleTree tree(blocks, threads);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (threads == 1) {
+            expected = tree.root();
+            serial_seconds = elapsed.count();
+        }
+        same_root = same_root && tree.root() == expected;
+        std::cout << threads << " thread(s): " << elapsed.count() * 1000 << " ms, "
+                  << kBlockSize * kBlockCount / elapsed.count() / 1e9 << " GB/s, speedup "
+                  << serial_seconds / elapsed.count() << "x" << std::endl;
+    }
+    std::cout << "64 MiB parallel roots identical: " << (same_root ? "(passed)" : "(failed)") << std::endl;
+}
+
+// 增量更新、批次更新與追加都必須與重新建構的根相同
+void test_incremental_updates() {
+    std::cout << "\n--- Incremental Updates ---" << std::endl;
+
+    const size_t n = 1000;
+    std::vector<std::string> blocks(n);
+    for (size_t i = 0; i < n; ++i) blocks[i] = "block-" + std::to_string(i);
+    MerkleTree tree(blocks);
+
+    bool single_ok = true;
+    uint32_t seed = 99;
+    for (int round = 0; round < 50; ++round) {
+        seed = seed * 1664525u + 1013904223u;
+        size_t index = seed % n;
+        blocks[index] = "updated-" + std::to_string(round);
+        tree.update(index, blocks[index]);
+        single_ok = single_ok && tree.root() == MerkleTree(blocks).root();
+    }
+    // 最右側的奇數節點 (與自身配對) 也要正確
+    blocks[n - 1] = "last";
+    tree.update(n - 1, blocks[n - 1]);
+    single_ok = single_ok && tree.root() == MerkleTree(blocks).root();
+    std::cout << "update(index, block) matches rebuild: " << (single_ok ? "(passed)" : "(failed)") << std::endl;
+
+    // 兩個兄弟葉節點：共同祖先只算一次 -> 剛好樹高個內部節點
+    std::vector<std::pair<size_t, std::string>> siblings = {{10, "s10"}, {11, "s11"}};
+    size_t rehashed = tree.update(siblings);
+    blocks[10] = "s10";
+    blocks[11] = "s11";
+    bool batch_ok = rehashed == 10 && tree.root() == MerkleTree(blocks).root(); // ceil(log2 1000) = 10
+    std::vector<std::pair<size_t, std::string>> batch;
+    for (size_t i = 0; i < 64; ++i) {
+        seed = seed * 1664525u + 1013904223u;
+        size_t index = seed % n;
+        batch.emplace_back(index, "batch-" + std::to_string(i));
+        blocks[index] = batch.back().second;
+    }
+    rehashed = tree.update(batch);
+    batch_ok = batch_ok && tree.root() == MerkleTree(blocks).root() && rehashed < 64 * 10;
+    std::cout << "Batched update rehashed " << rehashed << " nodes (vs " << 64 * 10
+              << " one by one), matches rebuild: " << (batch_ok ? "(passed)" : "(failed)") << std::endl;
+
+    bool append_ok = true;
+    MerkleTree growing(std::vector<std::string>{});
+    std::vector<std::string> entries;
+    for (size_t i = 0; i < 300; ++i) {
+        entries.push_back("entry-" + std::to_string(i));
+        growing.append(entries.back());
+        append_ok = append_ok && growing.root() == MerkleTree(entries).root() && growing.size() == entries.size();
+    }
+    std::cout << "append() matches rebuild for sizes 1..300: " << (append_ok ? "(passed)" : "(failed)") << std::endl;
+
+    bool verify_ok = tree.verify(blocks);
+    blocks[500] += "!";
+    verify_ok = verify_ok && !tree.verify(blocks) && !tree.verify(std::vector<std::string>(blocks.begin(), blocks.end() - 1));
+    std::cout << "verify() compares leaf hashes without a second tree: " << (verify_ok ? "(passed)" : "(failed)") << std::endl;
+
+    // 1M 葉節點：單一更新 vs 整棵重建
+    std::vector<std::string> big(1 << 20);
+    for (size_t i = 0; i < big.size(); ++i) big[i] = std::to_string(i);
+    auto start = std::chrono::steady_clock::now();
+    MerkleTree big_tree(big);
+    std::chrono::duration<double> rebuild = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < 1000; ++i) big_tree.update((i * 7919) % big.size(), "changed");
+    std::chrono::duration<double> updates = std::chrono::steady_clock::now() - start;
+    std::cout << "1M leaves: rebuild " << rebuild.count() * 1000 << " ms, single update "
+              << updates.count() * 1e6 / 1000 << " us" << std::endl;
+}
+
+// 每個大小、每個索引的證明都要能驗證；竄改資料、索引、兄弟或根都必須失敗
+void test_inclusion_proofs() {
+    std::cout << "\n--- Inclusion Proofs ---" << std::endl;
+
+    bool all_verify = true, tamper_rejected = true, round_trip = true;
+    for (size_t n = 1; n <= 70; ++n) {
+        std::vector<std::string> blocks(n);
+        for (size_t i = 0; i < n; ++i) blocks[i] = "block-" + std::to_string(i);
+        MerkleTree tree(blocks);
+        for (size_t i = 0; i < n; ++i) {
+            MerkleProof proof = tree.prove(i);
+            MerkleProof parsed = MerkleProof::parse(proof.serialize());
+            round_trip = round_trip && parsed.leaf_count == proof.leaf_count && parsed.siblings == proof.siblings;
+            all_verify = all_verify && verify_proof(blocks[i], i, parsed, tree.root());
+
+            tamper_rejected = tamper_rejected && !verify_proof(blocks[i] + "x", i, proof, tree.root());
+            if (n > 1) tamper_rejected = tamper_rejected && !verify_proof(blocks[i], (i + 1) % n, proof, tree.root());
+            if (!proof.siblings.empty()) {
+                MerkleProof bad = proof;
+                bad.siblings[0][0] ^= 1;
+                tamper_rejected = tamper_rejected && !verify_proof(blocks[i], i, bad, tree.root());
+            }
+            tamper_rejected = tamper_rejected && !verify_proof(blocks[i], n, proof, tree.root());
+        }
+    }
+    std::cout << "Proofs verify for every index of sizes 1..70: " << (all_verify ? "(passed)" : "(failed)") << std::endl;
+    std::cout << "Serialize/parse round trip: " << (round_trip ? "(passed)" : "(failed)") << std::endl;
+    std::cout << "Tampered leaf/index/sibling rejected: " << (tamper_rejected ? "(passed)" : "(failed)") << std::endl;
+
+    // 更新後舊證明失效，新證明有效
+    std::vector<std::string> blocks = {"a", "b", "c", "d", "e"};
+    MerkleTree tree(blocks);
+    MerkleProof old_proof = tree.prove(2);
+    tree.update(4, "e2");
+    bool after_update = !verify_proof("c", 2, old_proof, tree.root()) && verify_proof("c", 2, tree.prove(2), tree.root());
+    std::cout << "Proofs track updates: " << (after_update ? "(passed)" : "(failed)") << std::endl;
+
+    bool parse_errors = false;
+    try {
+        MerkleProof::parse(tree.prove(0).serialize().substr(0, 20));
+    } catch (const std::invalid_argument&) {
+        parse_errors = true;
+    }
+    std::cout << "Truncated proof rejected by parse: " << (parse_errors ? "(passed)" : "(failed)") << std::endl;
+
+    std::vector<std::string> big(1 << 20);
+    for (size_t i = 0; i < big.size(); ++i) big[i] = std::to_string(i);
+    MerkleTree big_tree(big);
+    std::string wire = big_tree.prove(123456).serialize();
+    bool big_ok = verify_proof(big[123456], 123456, MerkleProof::parse(wire), big_tree.root());
+    std::cout << "1M leaves: proof is " << wire.size() << " bytes, verifies "
+              << (big_ok && wire.size() == 644 ? "(passed)" : "(failed)") << std::endl;
+}
+
+// 差異比對必須回傳確切的改動區間，遠端版本只交換 O(差異數 × log n) 個摘要
+void test_replica_diff() {
+    std::cout << "\n--- Replica Diff ---" << std::endl;
+
+    std::vector<std::string> base(1000);
+    for (size_t i = 0; i < base.size(); ++i) base[i] = "block-" + std::to_string(i);
+    MerkleTree a(base);
+
+    std::vector<std::string> edited = base;
+    for (size_t i : {3, 4, 5, 500, 999}) edited[i] += "*";
+    MerkleTree b(edited);
+    std::vector<BlockRange> expected = {{3, 6}, {500, 501}, {999, 1000}};
+    bool local_ok = a.diff(a).empty() && a.diff(b) == expected && b.diff(a) == expected;
+
+    // 大小不同：尾端多出的資料塊整段視為差異
+    std::vector<std::string> longer = base;
+    for (size_t i = 0; i < 37; ++i) longer.push_back("extra-" + std::to_string(i));
+    longer[10] = "changed";
+    MerkleTree c(longer);
+    std::vector<BlockRange> expected_longer = {{10, 11}, {1000, 1037}};
+    local_ok = local_ok && a.diff(c) == expected_longer && c.diff(a) == expected_longer;
+    MerkleTree empty(std::vector<std::string>{});
+    local_ok = local_ok && empty.diff(a) == std::vector<BlockRange>{{0, 1000}} && empty.diff(empty).empty();
+    std::cout << "Local diff returns exact changed ranges: " << (local_ok ? "(passed)" : "(failed)") << std::endl;
+
+    // 64K 個資料塊的兩個副本，遠端改了 10 個
+    const size_t n = 64 * 1024;
+    std::vector<std::string> replica(n);
+    for (size_t i = 0; i < n; ++i) replica[i] = "record-" + std::to_string(i);
+    MerkleTree local(replica);
+    std::vector<std::string> remote_blocks = replica;
+    std::vector<BlockRange> remote_changes;
+    for (size_t k = 0; k < 10; ++k) {
+        size_t i = (k * 6553 + 17) % n;
+        remote_blocks[i] = "remote-edit-" + std::to_string(k);
+        remote_changes.push_back({i, i + 1});
+    }
+    MerkleTree remote(remote_blocks);
+
+    // 傳輸層替身：真實部署時 request 會經由 socket 送到另一個行程
+    size_t round_trips = 0, bytes_sent = 0, bytes_received = 0;
+    SyncRoundTrip transport = [&](const std::string& request) {
+        ++round_trips;
+        bytes_sent += request.size();
+        std::string response = remote.handle_sync_request(request);
+        bytes_received += response.size();
+        return response;
+    };
+    std::vector<BlockRange> ranges = local.diff_remote(transport);
+    bool remote_ok = ranges == remote_changes;
+    std::cout << "Remote diff: " << round_trips << " round trips, " << bytes_sent << " bytes sent, "
+              << bytes_received / 32 << " hashes received (full leaf exchange would be " << n << ") "
+              << (remote_ok && round_trips == 18 && bytes_received / 32 <= 10 * 2 * 17 ? "(passed)" : "(failed)")
+              << std::endl;
+
+    // 只複製有差異的資料塊，套用後兩邊的根相同
+    std::vector<std::pair<size_t, std::string>> patch;
+    for (const auto& r : ranges) {
+        for (size_t i = r.begin; i < r.end; ++i) patch.emplace_back(i, remote.block(i));
+    }
+    local.update(patch);
+    bool reconciled = local.root() == remote.root() && local.diff_remote(transport).empty();
+    std::cout << "Replicas reconciled after copying " << patch.size() << " blocks: "
+              << (reconciled ? "(passed)" : "(failed)") << std::endl;
+
+    bool rejected = false;
+    try {
+        remote.handle_sync_request(std::string(1, char(0x7f)));
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    std::cout << "Malformed sync request rejected: " << (rejected ? "(passed)" : "(failed)") << std::endl;
+}
+
+// n 個 LCG 產生的位元組；seed 會往前推，連續呼叫得到不同的內容
+std::vector<uint8_t> random_bytes(uint32_t& seed, size_t n) {
+    std::vector<uint8_t> data(n);
+    for (auto& byte : data) {
+        seed = seed * 1664525u + 1013904223u;
+        byte = uint8_t(seed >> 24);
+    }
+    return data;
+}
+
+// 把 data 寫進暫存檔並回傳路徑
+std::string write_temp_file(const std::vector<uint8_t>& data) {
+    char path[] = "/tmp/merkle_tree_XXXXXX";
+    int fd = ::mkstemp(path);
+    if (fd < 0) throw std::system_error(errno, std::generic_category(), "mkstemp");
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+        if (n < 0) {
+            ::close(fd);
+            throw std::system_error(errno, std::generic_category(), "write");
+        }
+        written += size_t(n);
+    }
+    ::close(fd);
+    return path;
+}
+
+// 檔案串流建構的根必須與把檔案切成 std::string 後建出的 MerkleTree 相同
+void test_file_hashing() {
+    std::cout << "\n--- Streaming File Hashing ---" << std::endl;
+
+    bool builder_ok = true;
+    std::vector<std::string> blocks;
+    for (size_t n = 1; n <= 100; ++n) {
+        blocks.push_back("leaf-" + std::to_string(n));
+        MerkleStreamBuilder builder;
+        for (const auto& b : blocks) builder.add_leaf_digest(hash_leaf(b.data(), b.size()));
+        builder_ok = builder_ok && builder.finish() == MerkleTree(blocks).root();
+    }
+    std::cout << "Stream builder matches MerkleTree for 1..100 leaves: " << (builder_ok ? "(passed)" : "(failed)") << std::endl;
+
+    uint32_t seed = 2024;
+    bool files_ok = true;
+    for (size_t file_size : {size_t(0), size_t(1), size_t(4095), size_t(4096), size_t(4097), (size_t(8) << 20) + 123}) {
+        std::vector<uint8_t> data = random_bytes(seed, file_size);
+        std::string path = write_temp_file(data);
+        for (size_t block_size : {size_t(4096), size_t(1000), size_t(1) << 20}) {
+            std::vector<std::string> chunks;
+            for (size_t off = 0; off < data.size(); off += block_size) {
+                chunks.emplace_back(reinterpret_cast<const char*>(data.data()) + off, std::min(block_size, data.size() - off));
+            }
+            Digest expected = MerkleTree(chunks).root();
+            FileMerkleSummary mapped = hash_file(path, block_size, true);
+            FileMerkleSummary streamed = hash_file(path, block_size, false);
+            files_ok = files_ok && mapped.root == expected && streamed.root == expected &&
+                       mapped.leaf_count == chunks.size() && mapped.bytes == file_size;
+        }
+        ::unlink(path.c_str());
+    }
+    std::cout << "mmap and read() roots match in-memory tree: " << (files_ok ? "(passed)" : "(failed)") << std::endl;
+
+    // pipe：read() 會短讀，切塊邊界仍需固定
+    std::vector<uint8_t> piped = random_bytes(seed, (size_t(3) << 20) + 77);
+    int fds[2];
+    bool pipe_ok = false;
+    if (::pipe(fds) == 0) {
+        std::thread writer([&] {
+            size_t off = 0;
+            while (off < piped.size()) {
+                ssize_t n = ::write(fds[1], piped.data() + off, std::min<size_t>(piped.size() - off, 1000));
+                if (n <= 0) break;
+                off += size_t(n);
+            }
+            ::close(fds[1]);
+        });
+        FileMerkleSummary summary = hash_file("/proc/self/fd/" + std::to_string(fds[0]), 4096);
+        writer.join();
+        ::close(fds[0]);
+        std::string whole(reinterpret_cast<const char*>(piped.data()), piped.size());
+        std::vector<std::string> chunks;
+        for (size_t off = 0; off < whole.size(); off += 4096) chunks.push_back(whole.substr(off, 4096));
+        pipe_ok = summary.root == MerkleTree(chunks).root();
+    }
+    std::cout << "Pipe input with short reads: " << (pipe_ok ? "(passed)" : "(failed)") << std::endl;
+
+    // 256 MiB 檔案、4 KiB 切塊
+    std::string path = write_temp_file(random_bytes(seed, size_t(256) << 20));
+    for (bool use_mmap : {true, false}) {
+        auto start = std::chrono::steady_clock::now();
+        FileMerkleSummary summary = hash_file(path, 4096, use_mmap);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << (use_mmap ? "mmap" : "read") << ": 256 MiB in " << elapsed.count() * 1000 << " ms ("
+                  << summary.bytes / elapsed.count() / 1e9 << " GB/s), " << summary.leaf_count << " leaves, "
+                  << summary.frontier_size << " frontier digests" << std::endl;
+    }
+    ::unlink(path.c_str());
+
+    bool missing = false;
+    try {
+        hash_file("/nonexistent/merkle_input", 4096);
+    } catch (const std::system_error&) {
+        missing = true;
+    }
+    std::cout << "Missing file reported as system_error: " << (missing ? "(passed)" : "(failed)") << std::endl;
+}
+
+// FastCDC：切塊大小限制、mmap / read() / 記憶體版本切點一致，以及編輯後的去重比例
+void test_content_defined_chunking() {
+    std::cout << "\n--- Content-Defined Chunking (FastCDC) ---" << std::endl;
+
+    uint32_t seed = 77;
+
+    const FastCdcChunker cdc(2 * 1024, 8 * 1024, 64 * 1024);
+    // 跨越 64 MiB 的 mmap 視窗，檢查切點在視窗邊界上的處理
+    std::vector<uint8_t> base = random_bytes(seed, (size_t(80) << 20) + 4321);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<size_t> lengths = cdc.chunk_lengths(base.data(), base.size());
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    bool sizes_ok = true;
+    for (size_t i = 0; i + 1 < lengths.size(); ++i) {
+        sizes_ok = sizes_ok && lengths[i] >= cdc.min_size() && lengths[i] <= cdc.max_size();
+    }
+    std::cout << "Chunker: " << base.size() / elapsed.count() / 1e9 << " GB/s, " << lengths.size()
+              << " chunks, average " << base.size() / lengths.size() << " bytes, all within [min, max] "
+              << (sizes_ok ? "(passed)" : "(failed)") << std::endl;
+
+    std::string path = write_temp_file(base);
+    std::vector<ChunkRecord> mapped_chunks, read_chunks;
+    FileMerkleSummary mapped = hash_file_chunked(path, cdc, true, &mapped_chunks);
+    FileMerkleSummary streamed = hash_file_chunked(path, cdc, false, &read_chunks);
+    bool same_cuts = mapped_chunks.size() == lengths.size() && read_chunks.size() == lengths.size();
+    for (size_t i = 0; same_cuts && i < lengths.size(); ++i) {
+        same_cuts = mapped_chunks[i].length == lengths[i] && read_chunks[i].length == lengths[i] &&
+                    mapped_chunks[i].digest == read_chunks[i].digest;
+    }
+    MerkleStreamBuilder reference;
+    for (size_t i = 0, offset = 0; i < lengths.size(); offset += lengths[i++]) {
+        reference.add_leaf_digest(hash_leaf(base.data() + offset, lengths[i]));
+    }
+    same_cuts = same_cuts && mapped.root == streamed.root && mapped.root == reference.finish();
+    std::cout << "mmap, read() and in-memory cut points and roots agree: " << (same_cuts ? "(passed)" : "(failed)")
+              << std::endl;
+    ::unlink(path.c_str());
+
+    // 編輯：開頭插入 1 位元組、中間插入 100 位元組、刪除 1000 位元組、覆寫 4 KiB
+    std::vector<uint8_t> edited = base;
+    edited.insert(edited.begin() + 100, uint8_t(0x42));
+    std::vector<uint8_t> inserted = random_bytes(seed, 100);
+    edited.insert(edited.begin() + (size_t(30) << 20), inserted.begin(), inserted.end());
+    edited.erase(edited.begin() + (size_t(50) << 20), edited.begin() + (size_t(50) << 20) + 1000);
+    std::vector<uint8_t> patch = random_bytes(seed, 4096);
+    std::copy(patch.begin(), patch.end(), edited.begin() + (size_t(70) << 20));
+    std::string old_path = write_temp_file(base), new_path = write_temp_file(edited);
+
+    // 去重比例：新檔案中已存在於舊檔案的塊所佔的位元組比例 (= 同步時不必重傳的比例)
+    auto dedup_ratio = [&](const std::vector<ChunkRecord>& old_chunks, const std::vector<ChunkRecord>& new_chunks) {
+        std::vector<Digest> known;
+        for (const auto& c : old_chunks) known.push_back(c.digest);
+        std::sort(known.begin(), known.end());
+        uint64_t reused = 0, total = 0;
+        for (const auto& c : new_chunks) {
+            total += c.length;
+            if (std::binary_search(known.begin(), known.end(), c.digest)) reused += c.length;
+        }
+        return total ? double(reused) / double(total) : 1.0;
+    };
+
+    std::vector<ChunkRecord> fixed_old, fixed_new, cdc_old, cdc_new;
+    hash_file_chunked(old_path, FixedSizeChunker(8 * 1024), true, &fixed_old);
+    hash_file_chunked(new_path, FixedSizeChunker(8 * 1024), true, &fixed_new);
+    start = std::chrono::steady_clock::now();
+    hash_file_chunked(old_path, cdc, true, &cdc_old);
+    FileMerkleSummary cdc_summary = hash_file_chunked(new_path, cdc, true, &cdc_new);
+    elapsed = std::chrono::steady_clock::now() - start;
+    ::unlink(old_path.c_str());
+    ::unlink(new_path.c_str());
+
+    double fixed_ratio = dedup_ratio(fixed_old, fixed_new), cdc_ratio = dedup_ratio(cdc_old, cdc_new);
+    std::cout << "Chunk + hash two 80 MiB files: " << (base.size() + edited.size()) / elapsed.count() / 1e9
+              << " GB/s, " << cdc_summary.leaf_count << " leaves" << std::endl;
+    std::cout << "Dedup after edits: fixed 8 KiB " << fixed_ratio * 100 << "%, FastCDC 2/8/64 KiB "
+              << cdc_ratio * 100 << "% " << (cdc_ratio > 0.99 && fixed_ratio < 0.01 ? "(passed)" : "(failed)")
+              << std::endl;
+}
+
 // main 函式用於測試
 int main() {
     std::cout << "--- Testing Merkle Tree ---" << std::endl;
@@ -112,6 +1747,15 @@ int main() {
     std::cout << "Verify original data against original tree: " << (tree1.verify(blocks1) ? "Success" : "Failed") << " (Expected: Success)" << std::endl;
     std::cout << "Verify modified data against original tree: " << (tree1.verify(blocks2) ? "Success" : "Failed") << " (Expected: Failed)" << std::endl;
 
+    test_hash_primitives();
+    test_leaf_hash_kernels();
+    test_parallel_build();
+    test_incremental_updates();
+    test_inclusion_proofs();
+    test_replica_diff();
+    test_file_hashing();
+    test_content_defined_chunking();
+
     std::cout << "--- Test Ended ---" << std::endl;
     return 0;
-}
\ No newline at end of file
+}
@@ -7,6 +7,12 @@
 #include <mutex>
 #include <thread>
 #include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+#include <queue>
+#include <vector>
+#include <random>
 
 /*
 [題目描述]
@@ -22,16 +28,72 @@
     c. **檢查容量**: 移除過期時間戳後，檢查 deque 的大小。如果大小小於速率限制 N，表示允許該請求。
     d. **記錄請求**: 如果允許，將當前時間戳 `now` 加入 deque 的後端，並回傳 true。否則，回傳 false。
 4.  **執行緒安全**: 所有對 deque 的讀寫操作都必須被一個 `std::mutex` 保護，以確保在多執行緒環境下的資料一致性。`std::lock_guard` 是一個方便的 RAII 工具，可以在建構時鎖定 mutex，並在解構時（離開作用域時）自動解鎖。
+
+[延伸: 批次 / 加權取得 (try_acquire / reserve)]
+一個 RPC 可能帶 500 個 item，每個都要算進額度。若呼叫 500 次 `should_allow`，就要鎖 500 次 mutex。
+1.  **加權日誌**: deque 的每個元素改成 `{time, permits}`，另外維護 `in_window` (窗口內 permits 總和)，
+    一次請求 n 個 permits 只佔用 deque 的一格，檢查容量也變成 O(1)。
+2.  **`try_acquire(n)`**: 鎖一次 mutex，若 `in_window + n <= N` 就整批放行，否則整批拒絕 (all-or-nothing)。
+3.  **`reserve(n)`**: 從 deque 前端往後累加「會先過期的」permits，直到剩下的量加上 n 不超過 N，
+    最後一個被跨過的元素過期的時間點 (`time + window`) 就是最早可用時間。
+    - 回傳時已經把這 n 個 permits「預訂」在那個時間點 (放進 deque)，呼叫者只要 `sleep_until` 即可，
+      不需要自己 spin 重試，也不會跟其他執行緒搶同一批額度。
+    - 預訂的時間點可能在未來；計算窗口時把未來的預訂也算進去，只會更保守，不會超量。
+    - 過期與預訂都靠 deque 依時間排序，所以 `should_allow` / `try_acquire` 也不能直接 `push_back`，
+      尾端是未來的預訂時要插在它前面。
+    - n > N 永遠無法滿足，丟 `std::invalid_argument`。
+
+[延伸: 自適應併發限制 (AdaptiveConcurrencyLimiter)]
+固定的 N 不是太小 (後端還有餘力) 就是太大 (後端排隊、延遲爆炸、吞吐反而下降)。
+改成「同時在途 (in-flight) 的請求數上限」，並且用量測到的延遲自動調整這個上限：
+1.  **介面**: `try_acquire()` 在 `inflight < limit` 時放行；請求結束時呼叫 `release(latency)` 回報延遲，
+    失敗 / 逾時則呼叫 `release_dropped()`。限制器本身不讀時鐘，所以可以直接餵虛擬時間做模擬。
+2.  **以「一輪」為單位更新**: 每收集約 `limit` 個樣本 (大約一個 RTT) 才用這一輪的平均延遲調整一次上限。
+    逐樣本更新會在同一個 RTT 內反應好幾十次，上限會劇烈震盪。
+3.  **no-load 延遲**: 記錄各輪平均延遲的最小值 `min_rtt`，當作「沒有排隊」時的基準。
+4.  **AIMD**: 平均延遲 <= `min_rtt * tolerance` 且上限有被用到時 +1；超過或有 drop 時乘上 `backoff`。
+5.  **Gradient**: `gradient = clamp(min_rtt / avg_rtt, 0.5, 1.0)`，
+    `new_limit = limit * gradient + sqrt(limit)`，再用 `smoothing` 做指數平滑。
+    - 沒排隊時 gradient ≈ 1，上限每次多出 `sqrt(limit)` 的排隊空間往上探。
+    - 超過膝點後延遲上升、gradient < 1，上限被拉回來；平衡點落在膝點附近加上一小段佇列。
+6.  **模擬**: 後端在 inflight <= C 時延遲固定，超過 C 後延遲以 `(inflight / C)^1.5` 成長，
+    也就是吞吐在 C (膝點) 達到最大、之後下降。用虛擬時間的事件模擬，比較固定上限與自適應上限。
 */
 
 // 解答 (Solution)
 class RateLimiter {
+public:
+    using TimePoint = std::chrono::steady_clock::time_point;
+
 private:
+    struct Entry {
+        TimePoint time;
+        int permits;
+    };
+
     const int max_requests;
     const std::chrono::seconds window_size;
-    std::deque<std::chrono::steady_clock::time_point> requests;
+    std::deque<Entry> requests;
+    int in_window = 0; // requests 內 permits 的總和
     std::mutex mtx;
 
+    // 呼叫前必須持有 mtx
+    void evict_expired(TimePoint now) {
+        while (!requests.empty() && requests.front().time <= now - window_size) {
+            in_window -= requests.front().permits;
+            requests.pop_front();
+        }
+    }
+
+    // 呼叫前必須持有 mtx。evict_expired 與 reserve 都假設 deque 依時間排序，
+    // 而尾端可能是 reserve 放進去的未來預訂，所以一律插在第一個比 at 晚的元素前面 (通常就是尾端)
+    void record(TimePoint at, int permits) {
+        auto pos = std::upper_bound(requests.begin(), requests.end(), at,
+                                    [](TimePoint t, const Entry& e) { return t < e.time; });
+        requests.insert(pos, {at, permits});
+        in_window += permits;
+    }
+
 public:
     RateLimiter(int n, int seconds = 1) : max_requests(n), window_size(seconds) {}
 
@@ -41,22 +103,221 @@ public:
         auto now = std::chrono::steady_clock::now();
 
         // 先把過期的彈掉
-        while (!requests.empty() && requests.front() <= now - window_size) {
-            requests.pop_front();
-        }
+        evict_expired(now);
 
         // 檢查size是否夠
-        if (requests.size() < max_requests) {
-            requests.push_back(now);
-            std::cout << "Request " << request_id << " allowed. Window count: " << requests.size() << std::endl;
+        if (in_window < max_requests) {
+            record(now, 1);
+            std::cout << "Request " << request_id << " allowed. Window count: " << in_window << std::endl;
             return true;
         } else {
-            std::cout << "Request " << request_id << " denied. Window count: " << requests.size() << std::endl;
+            std::cout << "Request " << request_id << " denied. Window count: " << in_window << std::endl;
+            return false;
+        }
+    }
+
+    // 一次取得 n 個 permits，全部給或全部不給
+    bool try_acquire(int n) {
+        if (n <= 0) {
+            return true;
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+
+        auto now = std::chrono::steady_clock::now();
+        evict_expired(now);
+
+        if (n > max_requests - in_window) {
             return false;
         }
+        record(now, n);
+        return true;
+    }
+
+    // 預訂 n 個 permits，回傳它們最早可用的時間點 (可能就是現在)
+    TimePoint reserve(int n) {
+        if (n > max_requests) {
+            throw std::invalid_argument("Requested permits exceed the rate limit.");
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+
+        auto now = std::chrono::steady_clock::now();
+        evict_expired(now);
+
+        TimePoint available_at = now;
+        int remaining = in_window;
+        for (const auto& e : requests) {
+            if (remaining + n <= max_requests) {
+                break;
+            }
+            remaining -= e.permits;
+            available_at = std::max(available_at, e.time + window_size);
+        }
+
+        if (n > 0) {
+            record(available_at, n);
+        }
+        return available_at;
     }
 };
 
+class AdaptiveConcurrencyLimiter {
+public:
+    enum class Algorithm { AIMD, Gradient };
+
+private:
+    const Algorithm algorithm;
+    const double min_limit;
+    const double max_limit;
+    const double tolerance = 1.2;  // AIMD: 延遲超過 min_rtt 的幾倍才算壅塞
+    const double backoff = 0.9;    // AIMD: 壅塞時的乘法遞減
+    const double smoothing = 0.2;  // Gradient: 新上限的平滑權重
+
+    double limit_;
+    int inflight_ = 0;
+    double min_rtt_us = 0;       // 0 代表尚未量測
+    // 目前這一輪 (約 limit 個樣本 ≈ 一個 RTT) 的統計
+    double window_rtt_sum_us = 0;
+    int window_samples = 0;
+    int window_max_inflight = 0;
+    int window_dropped_count = 0;
+    mutable std::mutex mtx;
+
+    // 呼叫前必須持有 mtx
+    void on_sample(double rtt_us, bool dropped) {
+        window_max_inflight = std::max(window_max_inflight, inflight_);
+        if (dropped) {
+            ++window_dropped_count;
+        } else {
+            window_rtt_sum_us += rtt_us;
+        }
+        if (++window_samples < static_cast<int>(limit_)) {
+            return;
+        }
+
+        // 一輪結束，用這一輪的平均延遲更新上限
+        bool window_dropped = window_dropped_count > 0;
+        int good_samples = window_samples - window_dropped_count;
+        double avg_rtt_us = good_samples > 0 ? window_rtt_sum_us / good_samples : 0;
+        // 有丟棄的一輪不拿來當基準: 剩下的樣本可能只是逾時前就先回來的那些，平均值偏低
+        if (!window_dropped && avg_rtt_us > 0 && (min_rtt_us == 0 || avg_rtt_us < min_rtt_us)) {
+            min_rtt_us = avg_rtt_us;
+        }
+
+        double new_limit = limit_;
+        if (algorithm == Algorithm::AIMD) {
+            if (window_dropped || avg_rtt_us > min_rtt_us * tolerance) {
+                new_limit = limit_ * backoff;
+            } else if (window_max_inflight * 2 >= limit_) {
+                new_limit = limit_ + 1;
+            }
+        } else {
+            double gradient = window_dropped || avg_rtt_us == 0
+                                  ? 0.5
+                                  : std::max(0.5, std::min(1.0, min_rtt_us / avg_rtt_us));
+            double queue_size = std::sqrt(limit_);
+            new_limit = limit_ * (1 - smoothing) + (limit_ * gradient + queue_size) * smoothing;
+        }
+        limit_ = std::max(min_limit, std::min(max_limit, new_limit));
+
+        window_rtt_sum_us = 0;
+        window_samples = 0;
+        window_max_inflight = 0;
+        window_dropped_count = 0;
+    }
+
+public:
+    AdaptiveConcurrencyLimiter(Algorithm algo, int initial_limit = 10, int min = 1, int max = 1000)
+        : algorithm(algo), min_limit(min), max_limit(max), limit_(initial_limit) {
+        if (min < 1 || min > max || initial_limit < min || initial_limit > max) {
+            throw std::invalid_argument("Invalid concurrency limit range.");
+        }
+    }
+
+    bool try_acquire() {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (inflight_ >= static_cast<int>(limit_)) {
+            return false;
+        }
+        ++inflight_;
+        return true;
+    }
+
+    // 請求成功完成，回報它的延遲
+    void release(std::chrono::microseconds latency) {
+        std::lock_guard<std::mutex> lock(mtx);
+        on_sample(static_cast<double>(latency.count()), false);
+        --inflight_;
+    }
+
+    // 請求失敗或逾時，視為壅塞訊號
+    void release_dropped() {
+        std::lock_guard<std::mutex> lock(mtx);
+        on_sample(0, true);
+        --inflight_;
+    }
+
+    int limit() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return static_cast<int>(limit_);
+    }
+
+    int inflight() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return inflight_;
+    }
+};
+
+// --- 自適應限制的模擬 (虛擬時間，不會真的 sleep) ---
+struct SimResult {
+    double throughput;     // requests / second
+    double avg_latency_ms;
+    double avg_limit;      // 後半段的平均上限 (只對自適應有意義)
+};
+
+// 合成後端: inflight <= knee 時延遲為 base，之後以 (inflight / knee)^1.5 成長
+double synthetic_latency_us(int inflight, int knee, double base_us, std::mt19937& rng) {
+    std::uniform_real_distribution<double> jitter(0.95, 1.05);
+    double load = std::max(1.0, static_cast<double>(inflight) / knee);
+    return base_us * std::pow(load, 1.5) * jitter(rng);
+}
+
+// fixed_limit > 0 時用固定上限，否則用 adaptive；需求無限 (每個空位都立刻被補上)
+SimResult simulate(AdaptiveConcurrencyLimiter* adaptive, int fixed_limit, int knee, double base_us,
+                   double duration_us) {
+    std::mt19937 rng(42);
+    std::priority_queue<std::pair<double, double>, std::vector<std::pair<double, double>>,
+                        std::greater<std::pair<double, double>>> completions; // {完成時間, 延遲}
+    double now = 0;
+    int inflight = 0;
+    long completed = 0;
+    double latency_sum = 0;
+    double limit_sum = 0;
+    long limit_samples = 0;
+
+    while (now < duration_us) {
+        while (adaptive ? adaptive->try_acquire() : inflight < fixed_limit) {
+            ++inflight;
+            double lat = synthetic_latency_us(inflight, knee, base_us, rng);
+            completions.push({now + lat, lat});
+        }
+        auto done = completions.top();
+        completions.pop();
+        now = done.first;
+        --inflight;
+        if (adaptive) {
+            adaptive->release(std::chrono::microseconds(static_cast<long long>(done.second)));
+        }
+        if (now >= duration_us / 2) { // 只統計收斂後的後半段
+            ++completed;
+            latency_sum += done.second;
+            limit_sum += adaptive ? adaptive->limit() : fixed_limit;
+            ++limit_samples;
+        }
+    }
+    return {completed / (duration_us / 2 / 1e6), latency_sum / completed / 1000.0,
+            limit_sum / limit_samples};
+}
+
 // main 函式用於測試
 int main() {
     std::cout << "--- Testing Rate Limiter ---" << std::endl;
@@ -78,6 +339,56 @@ int main() {
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
 
+    std::cout << "\n--- Batched Acquire ---" << std::endl;
+    {
+        RateLimiter batch_limiter(1000, 1);
+        bool a = batch_limiter.try_acquire(500);
+        bool b = batch_limiter.try_acquire(400);
+        bool c = batch_limiter.try_acquire(200); // 900 + 200 > 1000，整批拒絕
+        bool d = batch_limiter.try_acquire(100); // 剛好補滿
+        std::cout << "try_acquire(500/400/200/100): " << a << b << c << d
+                  << ((a && b && !c && d) ? " (passed)" : " (failed)") << std::endl;
+
+        auto start = std::chrono::steady_clock::now();
+        auto t1 = batch_limiter.reserve(600); // 要等前兩批 (500 + 400) 過期
+        auto wait_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - start).count();
+        std::cout << "reserve(600) available in " << wait_ms << " ms"
+                  << ((wait_ms > 900 && wait_ms <= 1000) ? " (passed)" : " (failed)") << std::endl;
+
+        // 預訂後額度已被佔住，現在再取也不會成功
+        std::cout << "try_acquire(1) after reserve: "
+                  << (batch_limiter.try_acquire(1) ? "allowed (failed)" : "denied (passed)") << std::endl;
+
+        std::this_thread::sleep_until(t1);
+        std::cout << "Woke up at reserved time, 600 permits are ours." << std::endl;
+    }
+
+    std::cout << "\n--- Adaptive Concurrency Simulation (knee = 32, base latency = 10 ms) ---" << std::endl;
+    {
+        const int knee = 32;
+        const double base_us = 10000;
+        const double duration_us = 60e6; // 虛擬的 60 秒
+
+        for (int fixed : {8, 32, 128}) {
+            SimResult r = simulate(nullptr, fixed, knee, base_us, duration_us);
+            std::cout << "Fixed limit " << fixed << ": " << static_cast<long>(r.throughput)
+                      << " req/s, avg latency " << r.avg_latency_ms << " ms" << std::endl;
+        }
+
+        const char* names[] = {"AIMD", "Gradient"};
+        AdaptiveConcurrencyLimiter::Algorithm algos[] = {AdaptiveConcurrencyLimiter::Algorithm::AIMD,
+                                                         AdaptiveConcurrencyLimiter::Algorithm::Gradient};
+        double best = knee / (base_us / 1e6);
+        for (int i = 0; i < 2; ++i) {
+            AdaptiveConcurrencyLimiter limiter(algos[i], 4);
+            SimResult r = simulate(&limiter, 0, knee, base_us, duration_us);
+            bool near_knee = r.avg_limit > knee * 0.7 && r.avg_limit < knee * 1.4 && r.throughput > best * 0.85;
+            std::cout << names[i] << ": " << static_cast<long>(r.throughput) << " req/s, avg latency "
+                      << r.avg_latency_ms << " ms, avg limit " << r.avg_limit
+                      << (near_knee ? " (converged near knee, passed)" : " (failed)") << std::endl;
+        }
+    }
+
     std::cout << "--- Test Ended ---" << std::endl;
     return 0;
 }
\ No newline at end of file
@@ -4,11 +4,30 @@
 #include <iostream>
 #include <cstdint>
 #include <chrono>
-#include <mutex>
+#include <atomic>
 #include <thread>
 #include <stdexcept>
 #include <vector>
 #include <set>
+#include <algorithm>
+#include <ctime>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define SNOWFLAKE_HAS_AVX2_KERNEL 1
+#else
+#define SNOWFLAKE_HAS_AVX2_KERNEL 0
+#endif
+
+#if __cplusplus >= 202002L && defined(__has_include)
+#if __has_include(<span>)
+#include <span>
+#define SNOWFLAKE_HAS_SPAN 1
+#endif
+#endif
+#ifndef SNOWFLAKE_HAS_SPAN
+#define SNOWFLAKE_HAS_SPAN 0
+#endif
 
 /*
 [題目描述]
@@ -22,77 +41,365 @@
 4.  **序列號 (12 bits)**: 代表在同一毫秒內，一台機器可以產生的 ID 數量 ($2^{12} = 4096$ 個)。每產生一個 ID，序列號就加一；進入下一毫秒時，序列號重置為 0。
 
 **執行緒安全與時鐘回撥**:
-- **執行緒安全**: 對 `last_timestamp` 和 `sequence` 的讀寫操作必須是原子的，因此需要使用 `std::mutex` 來保護。
+- **執行緒安全**: 對 `last_timestamp` 和 `sequence` 的讀寫操作必須是原子的。最直覺的作法是用 `std::mutex` 保護，
+  但這樣每個呼叫者都會被序列化，而且 `system_clock::now()` 也是在鎖裡面呼叫的。
 - **時鐘回撥**: 如果系統時鐘被向後調整，可能會產生重複的 ID。一個簡單的處理方式是，如果發現當前時間小於上次記錄的時間，就拋出異常。
+
+[延伸: 無鎖 (lock-free) 的 generate()]
+1.  **打包狀態**: 把 `last_timestamp` (相對 epoch) 和 `sequence` 打包進一個 64-bit 的 `std::atomic<int64_t>`:
+    `state = (timestamp - epoch) << sequence_bits | sequence`。兩個欄位一起用一次 CAS 更新，不會讀到一半的狀態。
+2.  **時鐘在鎖外讀**: 先讀時鐘，再 load `state`，然後算出下一個狀態:
+    - 新的一毫秒: `next = now << sequence_bits` (sequence 歸 0)。
+    - 同一毫秒且 sequence 未滿: `next = state + 1`，只動到 sequence 欄位。
+    - 同一毫秒且 sequence 用完: 在鎖外 spin 到下一毫秒再重試 (與原本的 `tilNextMillis` 相同)。
+    CAS 失敗代表別的執行緒先拿到了，`compare_exchange_weak` 會順便把最新值帶回來，直接重算即可。
+3.  **回撥判斷**: 無鎖之後，「讀到的時間 < state 內的時間」也可能只是自己讀時鐘後被搶先了，不一定是時鐘回撥。
+    所以遇到這種情況會在 load 之後再讀一次時鐘；state 內的時間一定是在這次讀取之前從時鐘讀到的，
+    若第二次仍然比較小，才是真的回撥，此時拋出異常。
+4.  **吞吐上限**: 12-bit sequence 代表一台機器每毫秒最多 4096 個 ID，也就是約 4.1M ids/sec。
+    這是 ID 格式本身的天花板，再多的執行緒也無法突破；無鎖版本的好處是接近這個上限時不會因為搶鎖而崩潰，
+    而且呼叫者不會在持有鎖的狀態下被排程出去。
+
+[延伸: 區塊預訂 generate_n(out, n) 與 thread-local 快取]
+1.  **一次預訂一段**: 因為 `state` 是打包後的整數，「sequence 加 n」就是 `state + n`；sequence 溢位時會自然
+    進位到 timestamp 欄位，也就是溢出到後面的毫秒。所以一次 CAS 就能預訂 `[start, start + n)` 這整段，
+    之後在鎖外把每個 state 轉成 ID 寫到 `out` 即可。
+2.  **state 可能超前時鐘**: 預訂溢出到未來的毫秒後，`state` 內的時間會比時鐘快。這不是回撥，
+    所以另外記錄 `clock_high_water` (所有執行緒讀到過的最大時鐘值)，只有「重讀的時鐘 < high-water」才算回撥；
+    `state` 只是被預訂推到前面時，`generate()` 直接借用 `state + 1`，等時鐘追上後自然回到正常路徑。
+    重讀時必須「先 load high-water 再讀時鐘」，high-water 裡的值才保證都是在這次讀時鐘之前讀到的。
+3.  **thread-local 區塊快取**: `generate_cached()` 每個執行緒持有一段預訂好的區塊 (`block_size` 個)，
+    用完才回到共享的 `state` 再預訂一次，平常每個 ID 只是一次區域變數的遞增。
+    - 代價: 不同執行緒拿到的 ID 不再依全域時間排序，快取中的 ID 時間戳也可能比實際取用時間舊。
+    - 區塊用 generator 的 `instance_id` 標記，換一個 generator (即使位址相同) 會重新預訂，不會沿用別人的區塊。
+
+[延伸: Hybrid Logical Clock 模式 (ClockMode::Hybrid)]
+Strict 模式遇到時鐘回撥就拋異常，sequence 用完就 spin 到下一毫秒 (整個核心被佔住)。
+Hybrid 模式把 `state` 當成 HLC: `max(時鐘, 上一個 state + 1)`。
+1.  **不丟異常、不 spin**: 時鐘停滯、回撥或 sequence 用完時，一律取 `state + 1`。
+    sequence 溢位會進位到 timestamp 欄位，等於向「邏輯計數」借用未來的毫秒。
+2.  **平滑回到時鐘**: 借用期間 `state` 會超前時鐘；一旦時鐘追上 (`時鐘 > state 的時間`)，就走回正常路徑
+    `state = 時鐘 << sequence_bits`，不會有跳躍或重複。`logical_lead_ms()` 可以觀察目前超前多少。
+3.  **便宜的粗粒度時鐘**: 快路徑讀 `CLOCK_REALTIME_COARSE` (vDSO 直接讀核心每個 tick 更新的值，不需讀 TSC)，
+    精度只有 1~4 ms，但不足的部分剛好由邏輯計數補上。沒有這個時鐘的平台退回 `system_clock`。
+4.  **代價**: ID 的時間戳在借用期間會比實際時間快；持續超過 4096/ms 的負載會讓超前量一直累積。
+
+[延伸: 可設定的位元配置與批次解碼]
+1.  **配置變成模板參數**: `SnowflakeLayout<TimestampBits, MachineIdBits, SequenceBits, EpochMillis, TimeUnit>`
+    描述各欄位寬度、紀元時間與時間單位 (例如 100 微秒)。產生器是 `BasicSnowflakeIDGenerator<Layout>`，
+    shift 與 mask 都是 `static constexpr`，編譯器可以直接把它們當成立即數。
+    `SnowflakeIDGenerator` 是預設配置 (41/10/12、2021 epoch、毫秒) 的別名，原本的用法不變。
+2.  **批次解碼 `decode`**: 分析工作要掃數十億個 ID，把 ID 拆成三個 column (SoA):
+    timestamp (int64，已加回 epoch)、machine ID 與 sequence (uint32)。
+    - x86-64 上若 CPU 支援 AVX2 (執行期 `__builtin_cpu_supports` 判斷一次)，一次處理 8 個 ID:
+      `vpsrlq` 位移、`vpand` 遮罩，再用 `vpermd` 把 64-bit lane 的低 32 bits 收攏成 uint32 column。
+    - 其他平台走純量迴圈；迴圈只有位移和遮罩，arm64 上編譯器會自動向量化成 NEON。
+    - C++20 下另外提供 `decode(std::span<const int64_t>)`。
 */
 
 // 解答 (Solution)
-class SnowflakeIDGenerator {
+
+// ID 的位元配置: 各欄位寬度、紀元時間 (毫秒) 與時間單位都是編譯期常數
+template <int TimestampBits, int MachineIdBits, int SequenceBits, int64_t EpochMillis,
+          typename TimeUnit = std::chrono::milliseconds>
+struct SnowflakeLayout {
+    static_assert(TimestampBits + MachineIdBits + SequenceBits == 63, "Layout must use exactly 63 bits.");
+    static_assert(MachineIdBits <= 32 && SequenceBits <= 32, "Machine ID and sequence must fit in 32 bits.");
+
+    using time_unit = TimeUnit;
+    static constexpr int64_t timestamp_bits = TimestampBits;
+    static constexpr int64_t machine_id_bits = MachineIdBits;
+    static constexpr int64_t sequence_bits = SequenceBits;
+    static constexpr int64_t epoch_millis = EpochMillis;
+};
+
+// 原本的配置: 41/10/12 bits，紀元時間 2021-01-01 00:00:00 UTC，單位毫秒
+using DefaultSnowflakeLayout = SnowflakeLayout<41, 10, 12, 1609459200000LL>;
+
+// decode() 的輸出，每個欄位一個連續的 column
+struct SnowflakeColumns {
+    std::vector<int64_t> timestamps;   // 從 Unix epoch 起算，單位為 layout 的 time_unit
+    std::vector<uint32_t> machine_ids;
+    std::vector<uint32_t> sequences;
+};
+
+template <typename Layout = DefaultSnowflakeLayout>
+class BasicSnowflakeIDGenerator {
+public:
+    enum class ClockMode { Strict, Hybrid };
+    using time_unit = typename Layout::time_unit;
+
 private:
-    const int64_t epoch = 1609459200000L; // 紀元時間: 2021-01-01 00:00:00 UTC
+    static constexpr int64_t epoch =
+        std::chrono::duration_cast<time_unit>(std::chrono::milliseconds(Layout::epoch_millis)).count();
 
-    const int64_t machine_id_bits = 10;
-    const int64_t sequence_bits = 12;
+    static constexpr int64_t machine_id_bits = Layout::machine_id_bits;
+    static constexpr int64_t sequence_bits = Layout::sequence_bits;
 
-    const int64_t max_machine_id = -1L ^ (-1L << machine_id_bits);
-    const int64_t max_sequence = -1L ^ (-1L << sequence_bits);
+    static constexpr int64_t max_machine_id = (1LL << machine_id_bits) - 1;
+    static constexpr int64_t max_sequence = (1LL << sequence_bits) - 1;
 
-    const int64_t machine_id_shift = sequence_bits;
-    const int64_t timestamp_shift = sequence_bits + machine_id_bits;
+    static constexpr int64_t machine_id_shift = sequence_bits;
+    static constexpr int64_t timestamp_shift = sequence_bits + machine_id_bits;
 
     int64_t machine_id;
-    int64_t sequence = 0L;
-    int64_t last_timestamp = -1L;
+    const int64_t block_size;
+    const ClockMode clock_mode;
+    const uint64_t instance_id;
+    std::atomic<int64_t> state{0}; // (last_timestamp - epoch) << sequence_bits | sequence
+    std::atomic<int64_t> clock_high_water{0}; // 讀到過的最大時鐘值 (相對 epoch)
 
-    std::mutex mtx;
+    static std::atomic<uint64_t>& instance_counter() {
+        static std::atomic<uint64_t> counter{0};
+        return counter;
+    }
 
-    int64_t getCurrentTimeMillis() {
-        return std::chrono::duration_cast<std::chrono::milliseconds>(
+    static int64_t getCurrentTime() {
+        return std::chrono::duration_cast<time_unit>(
             std::chrono::system_clock::now().time_since_epoch()
         ).count();
     }
 
-    int64_t tilNextMillis(int64_t lastTimestamp) {
-        int64_t timestamp = getCurrentTimeMillis();
+    static int64_t tilNextTime(int64_t lastTimestamp) {
+        int64_t timestamp = getCurrentTime();
         while (timestamp <= lastTimestamp) {
-            timestamp = getCurrentTimeMillis();
+            timestamp = getCurrentTime();
+        }
+        return timestamp;
+    }
+
+    // 粗粒度時鐘: 精度較差但成本很低，只在 Hybrid 模式使用。
+    // clock_gettime / CLOCK_REALTIME_COARSE 是 POSIX (後者是 Linux 專有)，標準 <ctime> 不保證有，所以用 #ifdef 擋
+    static int64_t getCoarseTime() {
+#ifdef CLOCK_REALTIME_COARSE
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+        return std::chrono::duration_cast<time_unit>(
+            std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec)
+        ).count();
+#else
+        return getCurrentTime();
+#endif
+    }
+
+    void observe_clock(int64_t timestamp) {
+        int64_t high_water = clock_high_water.load(std::memory_order_relaxed);
+        while (timestamp > high_water &&
+               !clock_high_water.compare_exchange_weak(high_water, timestamp, std::memory_order_release,
+                                                       std::memory_order_relaxed)) {
+        }
+    }
+
+    int64_t read_clock() {
+        if (clock_mode == ClockMode::Hybrid) {
+            return getCoarseTime() - epoch;
         }
+        int64_t timestamp = getCurrentTime() - epoch;
+        observe_clock(timestamp);
         return timestamp;
     }
 
+    // 讀到的時間落後 state 時呼叫: 先讀 high-water 再重讀時鐘，仍然落後 high-water 才是真的回撥
+    int64_t recheck_clock() {
+        int64_t high_water = clock_high_water.load(std::memory_order_acquire);
+        int64_t timestamp = getCurrentTime() - epoch;
+        if (timestamp < high_water) {
+            throw std::runtime_error("Clock moved backwards. Refusing to generate id.");
+        }
+        observe_clock(timestamp);
+        return timestamp;
+    }
+
+    int64_t to_id(int64_t packed) const {
+        return ((packed >> sequence_bits) << timestamp_shift) |
+               (machine_id << machine_id_shift) |
+               (packed & max_sequence);
+    }
+
+    // 一次 CAS 預訂 n 個連續的 state，回傳第一個；sequence 溢位會進位到後面的時間單位
+    int64_t reserve(int64_t n) {
+        int64_t timestamp = read_clock();
+        int64_t current = state.load(std::memory_order_acquire);
+        bool rechecked = false;
+
+        while (true) {
+            int64_t last_timestamp = current >> sequence_bits;
+            if (timestamp < last_timestamp && !rechecked && clock_mode == ClockMode::Strict) {
+                timestamp = recheck_clock();
+                rechecked = true;
+                continue;
+            }
+            int64_t start = timestamp > last_timestamp ? timestamp << sequence_bits : current + 1;
+            if (state.compare_exchange_weak(current, start + n - 1, std::memory_order_acq_rel,
+                                            std::memory_order_acquire)) {
+                return start;
+            }
+        }
+    }
+
 public:
-    SnowflakeIDGenerator(int64_t machineId) : machine_id(machineId) {
+    BasicSnowflakeIDGenerator(int64_t machineId, int64_t blockSize = 256, ClockMode mode = ClockMode::Strict)
+        : machine_id(machineId), block_size(blockSize), clock_mode(mode), instance_id(++instance_counter()) {
         if (machine_id < 0 || machine_id > max_machine_id) {
             throw std::invalid_argument("Machine ID is out of range.");
         }
+        if (block_size <= 0) {
+            throw std::invalid_argument("Block size must be positive.");
+        }
     }
 
     int64_t generate() {
-        std::lock_guard<std::mutex> lock(mtx);
+        int64_t timestamp = read_clock();
+        int64_t current = state.load(std::memory_order_acquire);
+        bool rechecked = false;
 
-        int64_t timestamp = getCurrentTimeMillis();
+        while (true) {
+            int64_t last_timestamp = current >> sequence_bits;
+            int64_t next;
 
-        if (timestamp < last_timestamp) {
-            throw std::runtime_error("Clock moved backwards. Refusing to generate id.");
-        }
+            if (timestamp > last_timestamp) {
+                next = timestamp << sequence_bits;
+            } else if (clock_mode == ClockMode::Hybrid) {
+                // 時鐘停滯、回撥或 sequence 用完: 向邏輯計數借用，溢位進位到下一個時間單位
+                next = current + 1;
+            } else if (timestamp < last_timestamp && !rechecked) {
+                // 可能只是讀時鐘後被搶先，或 state 被區塊預訂推到未來；重讀一次才能確定是不是回撥
+                timestamp = recheck_clock();
+                rechecked = true;
+                continue;
+            } else if (timestamp == last_timestamp && (current & max_sequence) == max_sequence) {
+                timestamp = tilNextTime(last_timestamp + epoch) - epoch;
+                observe_clock(timestamp);
+                current = state.load(std::memory_order_acquire);
+                continue;
+            } else {
+                // 同一個時間單位，或 state 超前時鐘 (借用，溢位會進位到下一個時間單位)
+                next = current + 1;
+            }
 
-        if (timestamp == last_timestamp) {
-            sequence = (sequence + 1) & max_sequence;
-            if (sequence == 0) {
-                timestamp = tilNextMillis(last_timestamp);
+            if (state.compare_exchange_weak(current, next, std::memory_order_acq_rel,
+                                            std::memory_order_acquire)) {
+                return to_id(next);
             }
-        } else {
-            sequence = 0L;
         }
+    }
 
-        last_timestamp = timestamp;
+    // state 的時間超前時鐘多少毫秒 (Hybrid 借用或區塊預訂造成)，0 代表已和時鐘同步
+    int64_t logical_lead_ms() {
+        int64_t lead = (state.load(std::memory_order_acquire) >> sequence_bits) -
+                       (getCurrentTime() - epoch);
+        return std::chrono::duration_cast<std::chrono::milliseconds>(time_unit(std::max<int64_t>(0, lead))).count();
+    }
 
-        return ((timestamp - epoch) << timestamp_shift) |
-               (machine_id << machine_id_shift) |
-               sequence;
+    // 預訂 n 個連續 ID 寫到 out，回傳寫完後的 iterator
+    template <typename OutputIt>
+    OutputIt generate_n(OutputIt out, int64_t n) {
+        if (n <= 0) {
+            return out;
+        }
+        int64_t start = reserve(n);
+        for (int64_t i = 0; i < n; ++i) {
+            *out++ = to_id(start + i);
+        }
+        return out;
     }
+
+    // thread-local 區塊快取模式: 每個執行緒一次預訂 block_size 個，平常只是遞增
+    int64_t generate_cached() {
+        struct LocalBlock {
+            uint64_t owner = 0;
+            int64_t next = 0;
+            int64_t end = 0;
+        };
+        thread_local LocalBlock block;
+
+        if (block.owner != instance_id || block.next == block.end) {
+            block.next = reserve(block_size);
+            block.end = block.next + block_size;
+            block.owner = instance_id;
+        }
+        return to_id(block.next++);
+    }
+
+    // 純量版本的批次解碼 (迴圈很單純，在 arm64 等平台交給編譯器自動向量化)
+    static void decode_scalar(const int64_t* ids, size_t n, int64_t* timestamps,
+                              uint32_t* machine_ids, uint32_t* sequences) {
+        for (size_t i = 0; i < n; ++i) {
+            timestamps[i] = (ids[i] >> timestamp_shift) + epoch;
+            machine_ids[i] = static_cast<uint32_t>((ids[i] >> machine_id_shift) & max_machine_id);
+            sequences[i] = static_cast<uint32_t>(ids[i] & max_sequence);
+        }
+    }
+
+    // 批次解碼: 把 ID 拆成 timestamp / machine / sequence 三個 column，x86 上有 AVX2 時一次處理 8 個
+    static void decode(const int64_t* ids, size_t n, int64_t* timestamps,
+                       uint32_t* machine_ids, uint32_t* sequences) {
+#if SNOWFLAKE_HAS_AVX2_KERNEL
+        static const bool use_avx2 = __builtin_cpu_supports("avx2");
+        if (use_avx2) {
+            decode_avx2(ids, n, timestamps, machine_ids, sequences);
+            return;
+        }
+#endif
+        decode_scalar(ids, n, timestamps, machine_ids, sequences);
+    }
+
+    static SnowflakeColumns decode(const int64_t* ids, size_t n) {
+        SnowflakeColumns columns;
+        columns.timestamps.resize(n);
+        columns.machine_ids.resize(n);
+        columns.sequences.resize(n);
+        decode(ids, n, columns.timestamps.data(), columns.machine_ids.data(), columns.sequences.data());
+        return columns;
+    }
+
+#if SNOWFLAKE_HAS_SPAN
+    static SnowflakeColumns decode(std::span<const int64_t> ids) {
+        return decode(ids.data(), ids.size());
+    }
+#endif
+
+private:
+#if SNOWFLAKE_HAS_AVX2_KERNEL
+    __attribute__((target("avx2")))
+    static void decode_avx2(const int64_t* ids, size_t n, int64_t* timestamps,
+                            uint32_t* machine_ids, uint32_t* sequences) {
+        const __m256i epoch_v = _mm256_set1_epi64x(epoch);
+        const __m256i machine_mask = _mm256_set1_epi64x(max_machine_id);
+        const __m256i sequence_mask = _mm256_set1_epi64x(max_sequence);
+        // 把 4 個 64-bit lane 的低 32 bits 收集到前 128 bits
+        const __m256i narrow = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ids + i));
+            __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ids + i + 4));
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(timestamps + i),
+                                _mm256_add_epi64(_mm256_srli_epi64(lo, timestamp_shift), epoch_v));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(timestamps + i + 4),
+                                _mm256_add_epi64(_mm256_srli_epi64(hi, timestamp_shift), epoch_v));
+
+            __m256i m_lo = _mm256_permutevar8x32_epi32(
+                _mm256_and_si256(_mm256_srli_epi64(lo, machine_id_shift), machine_mask), narrow);
+            __m256i m_hi = _mm256_permutevar8x32_epi32(
+                _mm256_and_si256(_mm256_srli_epi64(hi, machine_id_shift), machine_mask), narrow);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(machine_ids + i),
+                                _mm256_inserti128_si256(m_lo, _mm256_castsi256_si128(m_hi), 1));
+
+            __m256i s_lo = _mm256_permutevar8x32_epi32(_mm256_and_si256(lo, sequence_mask), narrow);
+            __m256i s_hi = _mm256_permutevar8x32_epi32(_mm256_and_si256(hi, sequence_mask), narrow);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(sequences + i),
+                                _mm256_inserti128_si256(s_lo, _mm256_castsi256_si128(s_hi), 1));
+        }
+        decode_scalar(ids + i, n - i, timestamps + i, machine_ids + i, sequences + i);
+    }
+#endif
 };
 
+// 預設配置的產生器，與原本的 SnowflakeIDGenerator 相同
+using SnowflakeIDGenerator = BasicSnowflakeIDGenerator<>;
+
 
 // main 函式用於測試
 int main() {
@@ -121,6 +428,188 @@ int main() {
             std::cout << *it << std::endl;
         }
 
+        std::cout << "\n--- Multi-threaded Uniqueness Stress Test ---" << std::endl;
+        const int num_threads = 16;
+        const int ids_per_thread = 200000;
+        std::vector<std::vector<int64_t>> per_thread(num_threads);
+        std::vector<std::thread> threads;
+
+        auto start = std::chrono::steady_clock::now();
+        for (int t = 0; t < num_threads; ++t) {
+            threads.emplace_back([&generator, &per_thread, t, ids_per_thread] {
+                per_thread[t].reserve(ids_per_thread);
+                for (int i = 0; i < ids_per_thread; ++i) {
+                    per_thread[t].push_back(generator.generate());
+                }
+            });
+        }
+        for (auto& th : threads) {
+            th.join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::vector<int64_t> all_ids;
+        all_ids.reserve(static_cast<size_t>(num_threads) * ids_per_thread);
+        bool per_thread_increasing = true;
+        for (const auto& ids : per_thread) {
+            per_thread_increasing = per_thread_increasing && std::is_sorted(ids.begin(), ids.end());
+            all_ids.insert(all_ids.end(), ids.begin(), ids.end());
+        }
+        std::sort(all_ids.begin(), all_ids.end());
+        bool unique = std::adjacent_find(all_ids.begin(), all_ids.end()) == all_ids.end();
+
+        std::cout << num_threads << " threads x " << ids_per_thread << " ids: "
+                  << static_cast<long>(all_ids.size() / seconds) << " ids/sec"
+                  << " (format ceiling: " << 4096 * 1000 << " ids/sec per machine id)" << std::endl;
+        std::cout << "Uniqueness across threads: " << (unique ? "passed" : "failed") << std::endl;
+        std::cout << "Per-thread monotonic: " << (per_thread_increasing ? "passed" : "failed") << std::endl;
+
+        std::cout << "\n--- Block Reservation (generate_n / generate_cached) ---" << std::endl;
+        SnowflakeIDGenerator bulk_generator(7, 1024);
+        std::vector<int64_t> block(10000);
+        bulk_generator.generate_n(block.begin(), static_cast<int64_t>(block.size()));
+        bool strictly_increasing = std::adjacent_find(block.begin(), block.end(),
+            [](int64_t a, int64_t b) { return a >= b; }) == block.end();
+        std::cout << "generate_n(10000) strictly increasing: " << (strictly_increasing ? "passed" : "failed")
+                  << std::endl;
+
+        // 三種 API 混用，確認彼此不會重複 (包含 state 被預訂推到未來時的 generate())
+        std::vector<std::vector<int64_t>> mixed(8);
+        std::vector<std::thread> mixed_threads;
+        for (int t = 0; t < 8; ++t) {
+            mixed_threads.emplace_back([&bulk_generator, &mixed, t] {
+                std::vector<int64_t> buffer(500);
+                for (int round = 0; round < 100; ++round) {
+                    mixed[t].push_back(bulk_generator.generate());
+                    bulk_generator.generate_n(buffer.begin(), static_cast<int64_t>(buffer.size()));
+                    mixed[t].insert(mixed[t].end(), buffer.begin(), buffer.end());
+                    for (int i = 0; i < 300; ++i) {
+                        mixed[t].push_back(bulk_generator.generate_cached());
+                    }
+                }
+            });
+        }
+        for (auto& th : mixed_threads) {
+            th.join();
+        }
+        std::vector<int64_t> mixed_all(block);
+        for (const auto& ids : mixed) {
+            mixed_all.insert(mixed_all.end(), ids.begin(), ids.end());
+        }
+        std::sort(mixed_all.begin(), mixed_all.end());
+        std::cout << "Mixed generate / generate_n / generate_cached uniqueness (" << mixed_all.size()
+                  << " ids): "
+                  << (std::adjacent_find(mixed_all.begin(), mixed_all.end()) == mixed_all.end() ? "passed" : "failed")
+                  << std::endl;
+
+        // 單執行緒每個 ID 的成本 (格式上限 4096/ms 仍然適用，n 大時 ID 會預訂到未來的毫秒)
+        const int64_t bench_n = 2000000;
+        std::vector<int64_t> sink(bench_n);
+        SnowflakeIDGenerator bench_single(1), bench_bulk(2), bench_cached(3, 4096);
+        auto t0 = std::chrono::steady_clock::now();
+        for (int64_t i = 0; i < bench_n; ++i) {
+            sink[i] = bench_single.generate();
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        bench_bulk.generate_n(sink.begin(), bench_n);
+        auto t2 = std::chrono::steady_clock::now();
+        for (int64_t i = 0; i < bench_n; ++i) {
+            sink[i] = bench_cached.generate_cached();
+        }
+        auto t3 = std::chrono::steady_clock::now();
+        auto ns_per_id = [bench_n](std::chrono::steady_clock::duration d) {
+            return std::chrono::duration<double, std::nano>(d).count() / bench_n;
+        };
+        std::cout << "ns/id: generate " << ns_per_id(t1 - t0) << ", generate_n " << ns_per_id(t2 - t1)
+                  << ", generate_cached " << ns_per_id(t3 - t2) << std::endl;
+
+        std::cout << "\n--- Custom Layout and Bulk Decode ---" << std::endl;
+        // 44-bit 時間 (單位 100 微秒，約 55 年)、11-bit 機器 ID、8-bit sequence
+        using FineLayout = SnowflakeLayout<44, 11, 8, 1609459200000LL,
+                                           std::chrono::duration<int64_t, std::ratio<1, 10000>>>;
+        using FineGenerator = BasicSnowflakeIDGenerator<FineLayout>;
+        FineGenerator fine_generator(2000);
+        std::vector<int64_t> fine_ids(1000);
+        fine_generator.generate_n(fine_ids.begin(), static_cast<int64_t>(fine_ids.size()));
+        SnowflakeColumns fine_columns = FineGenerator::decode(fine_ids.data(), fine_ids.size());
+        int64_t now_units = std::chrono::duration_cast<FineLayout::time_unit>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        bool fine_ok = true;
+        for (size_t i = 0; i < fine_ids.size(); ++i) {
+            fine_ok = fine_ok && fine_columns.machine_ids[i] == 2000 &&
+                      fine_columns.timestamps[i] > now_units - 10000 && fine_columns.timestamps[i] < now_units + 10000;
+        }
+        std::cout << "Custom layout (100us units, 2048 machines) round trip: " << (fine_ok ? "passed" : "failed")
+                  << std::endl;
+
+        const size_t decode_n = 1 << 22;
+        std::vector<int64_t> decode_ids(decode_n);
+        SnowflakeIDGenerator decode_generator(101, 4096);
+        decode_generator.generate_n(decode_ids.begin(), static_cast<int64_t>(decode_n));
+        std::vector<int64_t> ts_scalar(decode_n), ts_fast(decode_n);
+        std::vector<uint32_t> mid_scalar(decode_n), mid_fast(decode_n), seq_scalar(decode_n), seq_fast(decode_n);
+
+        auto d0 = std::chrono::steady_clock::now();
+        SnowflakeIDGenerator::decode_scalar(decode_ids.data(), decode_n, ts_scalar.data(), mid_scalar.data(),
+                                            seq_scalar.data());
+        auto d1 = std::chrono::steady_clock::now();
+        SnowflakeIDGenerator::decode(decode_ids.data(), decode_n, ts_fast.data(), mid_fast.data(), seq_fast.data());
+        auto d2 = std::chrono::steady_clock::now();
+
+        bool same = ts_scalar == ts_fast && mid_scalar == mid_fast && seq_scalar == seq_fast;
+        bool machine_ok = std::all_of(mid_fast.begin(), mid_fast.end(), [](uint32_t m) { return m == 101; });
+        bool reencode_ok = true;
+        for (size_t i = 0; i < decode_n; i += 4099) {
+            int64_t rebuilt = ((ts_fast[i] - 1609459200000LL) << 22) | (int64_t(mid_fast[i]) << 12) | seq_fast[i];
+            reencode_ok = reencode_ok && rebuilt == decode_ids[i];
+        }
+        double bytes = static_cast<double>(decode_n * sizeof(int64_t));
+        std::cout << "decode " << decode_n << " ids: scalar "
+                  << bytes / std::chrono::duration<double>(d1 - d0).count() / 1e9 << " GB/s, dispatched "
+                  << bytes / std::chrono::duration<double>(d2 - d1).count() / 1e9 << " GB/s"
+                  << ", columns match: " << ((same && machine_ok && reencode_ok) ? "passed" : "failed") << std::endl;
+
+        std::cout << "\n--- Sequence-Exhaustion Burst: Strict vs Hybrid ---" << std::endl;
+        const char* mode_names[] = {"Strict", "Hybrid"};
+        SnowflakeIDGenerator::ClockMode modes[] = {SnowflakeIDGenerator::ClockMode::Strict,
+                                                   SnowflakeIDGenerator::ClockMode::Hybrid};
+        for (int m = 0; m < 2; ++m) {
+            SnowflakeIDGenerator burst_generator(11, 256, modes[m]);
+            const int burst_n = 1000000;
+            std::vector<int64_t> latencies_ns(burst_n);
+            std::vector<int64_t> burst_ids(burst_n);
+            for (int i = 0; i < burst_n; ++i) {
+                auto call_start = std::chrono::steady_clock::now();
+                burst_ids[i] = burst_generator.generate();
+                latencies_ns[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - call_start).count();
+            }
+            int64_t lead_after_burst = burst_generator.logical_lead_ms();
+            bool increasing = std::adjacent_find(burst_ids.begin(), burst_ids.end(),
+                [](int64_t a, int64_t b) { return a >= b; }) == burst_ids.end();
+
+            std::sort(latencies_ns.begin(), latencies_ns.end());
+            auto pct = [&latencies_ns](double p) {
+                return latencies_ns[static_cast<size_t>(p * (latencies_ns.size() - 1))];
+            };
+            std::cout << mode_names[m] << ": p50 " << pct(0.50) << " ns, p99 " << pct(0.99)
+                      << " ns, p99.9 " << pct(0.999) << " ns, p99.99 " << pct(0.9999) << " ns, max " << latencies_ns.back()
+                      << " ns, lead after burst " << lead_after_burst << " ms, strictly increasing: "
+                      << (increasing ? "passed" : "failed") << std::endl;
+        }
+
+        // Hybrid: 借用的超前量在時鐘追上後歸零
+        SnowflakeIDGenerator hlc_generator(12, 256, SnowflakeIDGenerator::ClockMode::Hybrid);
+        std::vector<int64_t> ahead(4096 * 50);
+        hlc_generator.generate_n(ahead.begin(), static_cast<int64_t>(ahead.size())); // 推到未來約 50 ms
+        int64_t lead_before = hlc_generator.logical_lead_ms();
+        int64_t borrowed = hlc_generator.generate();
+        std::this_thread::sleep_for(std::chrono::milliseconds(lead_before + 10));
+        int64_t resynced = hlc_generator.generate();
+        std::cout << "Hybrid resync: lead " << lead_before << " ms -> " << hlc_generator.logical_lead_ms()
+                  << " ms after sleeping, ids still increasing: "
+                  << ((ahead.back() < borrowed && borrowed < resynced) ? "passed" : "failed") << std::endl;
+
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
     }